@@ -0,0 +1,283 @@
+#include "interpreter.hpp"
+#include "parser.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+
+// Every allocation made by the interpreter goes through here, so the count
+// between two points is the number of allocations a workload needed
+static std::atomic<std::size_t> g_allocations{0};
+
+void *operator new(std::size_t size) {
+  ++g_allocations;
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  ++g_allocations;
+  // aligned_alloc wants the size to be a multiple of the alignment
+  auto alignment = static_cast<std::size_t>(align);
+  size = (size + alignment - 1) / alignment * alignment;
+  if (void *ptr = std::aligned_alloc(alignment, size == 0 ? alignment : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return ::operator new(size, align);
+}
+
+// Every form of delete is replaced as well so that all of them go to free,
+// which is what the allocations above have to be given back to. They are
+// kept out of line so the compiler never pairs an inlined free with a call
+// to operator new.
+[[gnu::noinline]] void operator delete(void *ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete[](void *ptr) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete[](void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete(void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete[](void *ptr,
+                                         std::align_val_t) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete(void *ptr, std::size_t,
+                                       std::align_val_t) noexcept {
+  std::free(ptr);
+}
+[[gnu::noinline]] void operator delete[](void *ptr, std::size_t,
+                                         std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Each workload is timed for at least this long
+constexpr auto min_time = std::chrono::milliseconds(200);
+
+struct Workload {
+  std::string name;
+  // Evaluated once before timing, e.g. to define functions
+  std::string setup;
+  // Evaluated once per op, unless op is set
+  std::string expr;
+  std::function<void()> op;
+};
+
+long peak_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void eval(Interpreter &interpreter, std::string_view source) {
+  for (auto &form : split_forms(parse(source))) {
+    interpreter.run(interpreter.compile(std::move(form)));
+  }
+}
+
+// Runs op in batches of doubling size until min_time has passed and prints
+// one JSON object per workload
+void measure(const std::string &name, const std::function<void()> &op) {
+  std::size_t iterations = 0;
+  std::size_t batch = 1;
+  std::size_t allocations = g_allocations;
+  auto start = Clock::now();
+  auto elapsed = Clock::duration::zero();
+
+  while (elapsed < min_time) {
+    for (std::size_t i = 0; i < batch; i++) {
+      op();
+    }
+    iterations += batch;
+    batch *= 2;
+    elapsed = Clock::now() - start;
+  }
+
+  allocations = g_allocations - allocations;
+  auto ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  std::printf("{\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, "
+              "\"allocs_per_op\": %.1f, \"peak_rss_kb\": %ld}\n",
+              name.c_str(), iterations, ns / iterations,
+              (double)allocations / iterations, peak_rss_kb());
+  std::fflush(stdout);
+}
+
+std::string quoted_list(std::size_t n) {
+  std::string source = "'(";
+  for (std::size_t i = 0; i < n; i++) {
+    source += std::to_string(i) + " ";
+  }
+  source += ")";
+  return source;
+}
+
+// Each function in the chain calls the one defined before it, so a call to
+// the last one looks up every name in the chain once
+std::string call_chain(std::size_t depth) {
+  std::string source = "(defn chain0 [x] (+ x 1))\n";
+  for (std::size_t i = 1; i < depth; i++) {
+    source += "(defn chain" + std::to_string(i) + " [x] (chain" +
+              std::to_string(i - 1) + " x))\n";
+  }
+  return source;
+}
+
+std::string large_source(std::size_t forms) {
+  std::string source;
+  for (std::size_t i = 0; i < forms; i++) {
+    source += "(defn square" + std::to_string(i) +
+              " [x] (* x x)) ; squares x\n(map square" + std::to_string(i) +
+              " [1 2 3 4 5])\n";
+  }
+  return source;
+}
+
+// One function whose body nests its ifs depth deep
+std::string nested_source(std::size_t depth) {
+  std::string source = "(defn nested [x] ";
+  for (std::size_t i = 0; i < depth; i++) {
+    auto n = std::to_string(i);
+    source += "(if (= x " + n + ") (" + n + ") ";
+  }
+  source += "(0)" + std::string(depth, ')') + ")\n";
+  return source;
+}
+
+std::vector<Workload> workloads() {
+  std::vector<Workload> list;
+
+  const std::string fns = "(defn fib [n] (if (< n 2) (n) (+ (fib (- n 1)) "
+                          "(fib (- n 2)))))\n"
+                          "(defn square [x] (* x x))\n"
+                          "(defn even [x] (= (rem x 2) 0))\n"
+                          "(defn add [a b] (+ a b))\n"
+                          "(defn seconds [d] (+ (* d 60 60 24) (sqrt 1024)))\n";
+
+  for (int n : {15, 20, 25}) {
+    list.push_back({"fib/" + std::to_string(n), fns,
+                    "(fib " + std::to_string(n) + ")", {}});
+  }
+
+  // Defined again each time, so that every op starts with an empty cache
+  for (int n : {25, 40}) {
+    list.push_back({"fib_memo/" + std::to_string(n), "",
+                    "(defn_memo mfib [n] (if (< n 2) (n) (+ (mfib (- n 1)) "
+                    "(mfib (- n 2)))))\n(mfib " +
+                        std::to_string(n) + ")",
+                    {}});
+  }
+
+  // map and filter are lazy, conj makes them build the whole vector
+  for (int n : {1000, 10000, 100000, 1000000}) {
+    auto range = "(range 1 " + std::to_string(n) + ")";
+    auto size = std::to_string(n);
+    list.push_back(
+        {"map/" + size, fns, "(conj (map square " + range + "))", {}});
+    list.push_back(
+        {"filter/" + size, fns, "(conj (filter even " + range + "))", {}});
+    list.push_back({"reduce/" + size, fns, "(reduce add " + range + ")", {}});
+    list.push_back(
+        {"pmap/" + size, fns, "(conj (pmap square " + range + "))", {}});
+    list.push_back(
+        {"pfilter/" + size, fns, "(conj (pfilter even " + range + "))", {}});
+    list.push_back(
+        {"preduce/" + size, fns, "(preduce add " + range + ")", {}});
+  }
+
+  for (int n : {1000, 100000, 10000000}) {
+    list.push_back({"fused/" + std::to_string(n), fns,
+                    "(reduce add (map square (filter even (range 1 " +
+                        std::to_string(n) + "))))",
+                    {}});
+  }
+
+  // Constant arithmetic in a function body, which is folded when it is
+  // defined
+  for (int n : {1000, 100000}) {
+    list.push_back({"constants/" + std::to_string(n), fns,
+                    "(reduce add (map seconds (range 1 " + std::to_string(n) +
+                        ")))",
+                    {}});
+  }
+
+  for (int depth : {10, 100, 1000}) {
+    list.push_back({"lookup/" + std::to_string(depth), call_chain(depth),
+                    "(chain" + std::to_string(depth - 1) + " 0)", {}});
+  }
+
+  for (int forms : {1000, 10000}) {
+    auto source = std::make_shared<std::string>(large_source(forms));
+    list.push_back({"tokenize/" + std::to_string(source->size()), "", "",
+                    [source] { parse(*source); }});
+  }
+
+  for (int depth : {100, 1000}) {
+    auto tokens =
+        std::make_shared<std::vector<Token>>(parse(nested_source(depth)));
+    auto interpreter = std::make_shared<Interpreter>();
+    list.push_back({"compile/" + std::to_string(depth), "", "",
+                    [tokens, interpreter] { interpreter->compile(*tokens); }});
+  }
+
+  for (int n : {100, 1000, 10000}) {
+    auto setup = "(def data " + quoted_list(n) + ")";
+    auto size = std::to_string(n);
+    list.push_back({"len/" + size, setup, "(len data)", {}});
+    list.push_back({"nth/" + size, setup,
+                    "(nth " + std::to_string(n - 1) + " data)", {}});
+  }
+
+  return list;
+}
+
+} // namespace
+
+// Usage: lispy-bench [filter]
+// Only workloads whose name contains filter are run.
+int main(int argc, char **argv) {
+  std::string_view filter = argc > 1 ? argv[1] : "";
+
+  for (auto &workload : workloads()) {
+    if (workload.name.find(filter) == std::string::npos) {
+      continue;
+    }
+
+    Interpreter interpreter;
+    eval(interpreter, workload.setup);
+
+    if (workload.op) {
+      measure(workload.name, workload.op);
+      continue;
+    }
+
+    auto program = interpreter.compile(parse(workload.expr));
+    measure(workload.name, [&] { interpreter.run(program); });
+  }
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+#include "bigint.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+
+BigInt::BigInt(std::int64_t value) : m_negative(value < 0) {
+  auto magnitude = m_negative ? 0 - (std::uint64_t)value : (std::uint64_t)value;
+  while (magnitude != 0) {
+    m_limbs.push_back((std::uint32_t)magnitude);
+    magnitude >>= 32;
+  }
+}
+
+BigInt::BigInt(bool negative, Limbs limbs)
+    : m_negative(negative), m_limbs(std::move(limbs)) {
+  trim(m_limbs);
+  if (m_limbs.empty()) {
+    m_negative = false;
+  }
+}
+
+void BigInt::trim(Limbs &limbs) {
+  while (!limbs.empty() && limbs.back() == 0) {
+    limbs.pop_back();
+  }
+}
+
+std::optional<BigInt> BigInt::parse(std::string_view text) {
+  bool negative = !text.empty() && text[0] == '-';
+  if (negative) {
+    text.remove_prefix(1);
+  }
+  if (text.empty()) {
+    return std::nullopt;
+  }
+
+  Limbs limbs;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return std::nullopt;
+    }
+    // limbs = limbs * 10 + digit
+    std::uint64_t carry = c - '0';
+    for (auto &limb : limbs) {
+      auto product = (std::uint64_t)limb * 10 + carry;
+      limb = (std::uint32_t)product;
+      carry = product >> 32;
+    }
+    if (carry != 0) {
+      limbs.push_back((std::uint32_t)carry);
+    }
+  }
+  return BigInt(negative, std::move(limbs));
+}
+
+BigInt BigInt::from_limbs(bool negative, std::vector<std::uint32_t> limbs) {
+  return BigInt(negative, std::move(limbs));
+}
+
+std::optional<std::int64_t> BigInt::to_int64() const {
+  if (m_limbs.size() > 2) {
+    return std::nullopt;
+  }
+  std::uint64_t magnitude = 0;
+  for (std::size_t i = m_limbs.size(); i-- > 0;) {
+    magnitude = magnitude << 32 | m_limbs[i];
+  }
+  constexpr auto max = (std::uint64_t)std::numeric_limits<std::int64_t>::max();
+  if (!m_negative) {
+    return magnitude <= max ? std::optional((std::int64_t)magnitude)
+                            : std::nullopt;
+  }
+  return magnitude <= max + 1 ? std::optional((std::int64_t)(0 - magnitude))
+                              : std::nullopt;
+}
+
+double BigInt::to_double() const {
+  double value = 0;
+  for (std::size_t i = m_limbs.size(); i-- > 0;) {
+    value = value * 4294967296.0 + m_limbs[i];
+  }
+  return m_negative ? -value : value;
+}
+
+std::string BigInt::to_string() const {
+  if (m_limbs.empty()) {
+    return "0";
+  }
+
+  // Nine decimal digits at a time, least significant first
+  std::vector<std::uint32_t> chunks;
+  auto rest = m_limbs;
+  while (!rest.empty()) {
+    chunks.push_back(div_small(rest, 1000000000));
+  }
+
+  std::string out = m_negative ? "-" : "";
+  out += std::to_string(chunks.back());
+  for (std::size_t i = chunks.size() - 1; i-- > 0;) {
+    auto digits = std::to_string(chunks[i]);
+    out.append(9 - digits.size(), '0');
+    out += digits;
+  }
+  return out;
+}
+
+BigInt BigInt::operator-() const { return BigInt(!m_negative, m_limbs); }
+
+int BigInt::compare_magnitude(const Limbs &a, const Limbs &b) {
+  if (a.size() != b.size()) {
+    return a.size() < b.size() ? -1 : 1;
+  }
+  for (std::size_t i = a.size(); i-- > 0;) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+BigInt::Limbs BigInt::add_magnitude(const Limbs &a, const Limbs &b) {
+  const auto &longer = a.size() >= b.size() ? a : b;
+  const auto &shorter = a.size() >= b.size() ? b : a;
+  Limbs sum(longer.size() + 1);
+  std::uint64_t carry = 0;
+  for (std::size_t i = 0; i < longer.size(); i++) {
+    carry += (std::uint64_t)longer[i] + (i < shorter.size() ? shorter[i] : 0);
+    sum[i] = (std::uint32_t)carry;
+    carry >>= 32;
+  }
+  sum[longer.size()] = (std::uint32_t)carry;
+  trim(sum);
+  return sum;
+}
+
+BigInt::Limbs BigInt::sub_magnitude(const Limbs &a, const Limbs &b) {
+  Limbs difference(a.size());
+  std::int64_t borrow = 0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    auto value = (std::int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+    borrow = value < 0;
+    difference[i] = (std::uint32_t)(value + (borrow << 32));
+  }
+  trim(difference);
+  return difference;
+}
+
+BigInt::Limbs BigInt::mul_magnitude(const Limbs &a, const Limbs &b) {
+  if (a.empty() || b.empty()) {
+    return {};
+  }
+  // Growing a big number by a small one is the common case, and needs only
+  // the one pass
+  if (a.size() < b.size()) {
+    return mul_magnitude(b, a);
+  }
+  if (b.size() == 1) {
+    Limbs product(a.size() + 1);
+    std::uint64_t carry = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+      carry += (std::uint64_t)a[i] * b[0];
+      product[i] = (std::uint32_t)carry;
+      carry >>= 32;
+    }
+    product[a.size()] = (std::uint32_t)carry;
+    trim(product);
+    return product;
+  }
+
+  Limbs product(a.size() + b.size());
+  for (std::size_t i = 0; i < a.size(); i++) {
+    std::uint64_t carry = 0;
+    for (std::size_t j = 0; j < b.size(); j++) {
+      carry += (std::uint64_t)a[i] * b[j] + product[i + j];
+      product[i + j] = (std::uint32_t)carry;
+      carry >>= 32;
+    }
+    product[i + b.size()] = (std::uint32_t)carry;
+  }
+  trim(product);
+  return product;
+}
+
+std::uint32_t BigInt::div_small(Limbs &a, std::uint32_t divisor) {
+  std::uint64_t remainder = 0;
+  for (std::size_t i = a.size(); i-- > 0;) {
+    auto current = remainder << 32 | a[i];
+    a[i] = (std::uint32_t)(current / divisor);
+    remainder = current % divisor;
+  }
+  trim(a);
+  return (std::uint32_t)remainder;
+}
+
+BigInt BigInt::add_signed(const BigInt &a, bool b_negative, const Limbs &b) {
+  if (a.m_negative == b_negative) {
+    return BigInt(b_negative, add_magnitude(a.m_limbs, b));
+  }
+  if (compare_magnitude(a.m_limbs, b) >= 0) {
+    return BigInt(a.m_negative, sub_magnitude(a.m_limbs, b));
+  }
+  return BigInt(b_negative, sub_magnitude(b, a.m_limbs));
+}
+
+BigInt operator+(const BigInt &a, const BigInt &b) {
+  return BigInt::add_signed(a, b.m_negative, b.m_limbs);
+}
+
+BigInt operator-(const BigInt &a, const BigInt &b) {
+  return BigInt::add_signed(a, !b.m_negative && !b.is_zero(), b.m_limbs);
+}
+
+BigInt operator*(const BigInt &a, const BigInt &b) {
+  return BigInt(a.m_negative != b.m_negative,
+                BigInt::mul_magnitude(a.m_limbs, b.m_limbs));
+}
+
+void BigInt::divmod(const BigInt &a, const BigInt &b, BigInt &quotient,
+                    BigInt &remainder) {
+  if (b.m_limbs.size() == 1) {
+    auto limbs = a.m_limbs;
+    auto rest = div_small(limbs, b.m_limbs[0]);
+    quotient = BigInt(a.m_negative != b.m_negative, std::move(limbs));
+    remainder = BigInt(a.m_negative, Limbs{rest});
+    return;
+  }
+
+  // One bit at a time, which is plenty for numbers of a few hundred digits
+  Limbs q(a.m_limbs.size());
+  Limbs r;
+  for (std::size_t bit = a.m_limbs.size() * 32; bit-- > 0;) {
+    std::uint32_t carry = (a.m_limbs[bit / 32] >> (bit % 32)) & 1;
+    for (auto &limb : r) {
+      auto next = limb >> 31;
+      limb = limb << 1 | carry;
+      carry = next;
+    }
+    if (carry != 0) {
+      r.push_back(carry);
+    }
+    if (compare_magnitude(r, b.m_limbs) >= 0) {
+      r = sub_magnitude(r, b.m_limbs);
+      q[bit / 32] |= 1u << (bit % 32);
+    }
+  }
+  quotient = BigInt(a.m_negative != b.m_negative, std::move(q));
+  remainder = BigInt(a.m_negative, std::move(r));
+}
+
+int compare(const BigInt &a, const BigInt &b) {
+  if (a.m_negative != b.m_negative) {
+    return a.m_negative ? -1 : 1;
+  }
+  auto order = BigInt::compare_magnitude(a.m_limbs, b.m_limbs);
+  return a.m_negative ? -order : order;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// An integer of any size: a sign and a magnitude in base 2^32 limbs, least
+// significant first and without leading zero limbs (zero has none). Only the
+// numbers that do not fit in 64 bits are ever stored as one (see number.hpp).
+class BigInt {
+public:
+  BigInt() = default;
+  explicit BigInt(std::int64_t value);
+
+  // Decimal digits, with an optional leading '-'
+  static std::optional<BigInt> parse(std::string_view text);
+  // The inverse of negative() and limbs()
+  static BigInt from_limbs(bool negative, std::vector<std::uint32_t> limbs);
+
+  bool is_zero() const { return m_limbs.empty(); }
+  bool negative() const { return m_negative; }
+  std::optional<std::int64_t> to_int64() const;
+  double to_double() const;
+  std::string to_string() const;
+
+  BigInt operator-() const;
+  friend BigInt operator+(const BigInt &a, const BigInt &b);
+  friend BigInt operator-(const BigInt &a, const BigInt &b);
+  friend BigInt operator*(const BigInt &a, const BigInt &b);
+  // Truncates towards zero, and the remainder takes the dividend's sign, as
+  // with int. The divisor must not be zero.
+  static void divmod(const BigInt &a, const BigInt &b, BigInt &quotient,
+                     BigInt &remainder);
+
+  // Negative, zero or positive as a is less than, equal to or more than b
+  friend int compare(const BigInt &a, const BigInt &b);
+
+  const std::vector<std::uint32_t> &limbs() const { return m_limbs; }
+
+private:
+  using Limbs = std::vector<std::uint32_t>;
+
+  bool m_negative = false;
+  Limbs m_limbs;
+
+  BigInt(bool negative, Limbs limbs);
+
+  static int compare_magnitude(const Limbs &a, const Limbs &b);
+  static Limbs add_magnitude(const Limbs &a, const Limbs &b);
+  // a must be at least b
+  static Limbs sub_magnitude(const Limbs &a, const Limbs &b);
+  static Limbs mul_magnitude(const Limbs &a, const Limbs &b);
+  // Divides a in place, returning the remainder
+  static std::uint32_t div_small(Limbs &a, std::uint32_t divisor);
+  static void trim(Limbs &limbs);
+  static BigInt add_signed(const BigInt &a, bool b_negative, const Limbs &b);
+};
@@ -0,0 +1,223 @@
+#include "bytecode.hpp"
+#include "core.hpp"
+#include "expr.hpp"
+#include "jit.hpp"
+#include "memo.hpp"
+#include "node.hpp"
+#include "parser.hpp"
+#include "symbol.hpp"
+#include "variable.hpp"
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+
+namespace {
+
+class Compiler {
+private:
+  Chunk &m_chunk;
+  // Of the expression being compiled, for the instructions it emits
+  Span m_span;
+
+  std::size_t emit(OpCode op, std::uint32_t arg = 0, std::uint16_t argc = 0) {
+    m_chunk.code.push_back({op, argc, arg});
+    m_chunk.spans.push_back(m_span);
+    return m_chunk.code.size() - 1;
+  }
+
+  std::uint32_t constant(Node node) {
+    m_chunk.constants.push_back(std::move(node));
+    return m_chunk.constants.size() - 1;
+  }
+
+  void patch(std::size_t jump) { m_chunk.code[jump].arg = m_chunk.code.size(); }
+
+  // Compiles args as the arguments of a call. A literal that the builtin
+  // being called can never accept is an error now rather than when the call
+  // runs.
+  std::uint16_t arguments(std::span<const Expr> args,
+                          const Builtin *native = nullptr) {
+    std::uint16_t argc = 0;
+    for (const auto &arg : args) {
+      if (native != nullptr && !arg.is_form() && is_literal(arg.node) &&
+          (native->max_args == Builtin::Variadic || argc < native->max_args) &&
+          !native->accepts(argc, arg.node)) {
+        native->wrong_type(argc);
+      }
+      expression(arg);
+      ++argc;
+    }
+    if (native != nullptr) {
+      native->check_arity(argc);
+    }
+    return argc;
+  }
+
+  static bool is_literal(const Node &node) {
+    switch (node.type) {
+    case Node::Number:
+    case Node::Bool:
+    case Node::Vec:
+    case Node::List:
+    case Node::Operator:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  void if_form(const Expr &expr, bool tail) {
+    expression(expr.items[1]);
+    auto to_else = emit(OpCode::JumpIfFalse);
+    expression(expr.items[2], tail);
+    auto to_end = emit(OpCode::Jump);
+    patch(to_else);
+    expression(expr.items[3], tail);
+    patch(to_end);
+  }
+
+  void defn_form(const Expr &expr, bool memoized) {
+    auto name = expr.items[1].node.as<SymbolId>();
+    const auto &params = expr.items[2].node.as<Vector>();
+    const auto &body = expr.items[3];
+
+    auto code = std::make_shared<Chunk>();
+    code->source = m_chunk.source;
+    Compiler inner{*code};
+    inner.function(body);
+
+    std::shared_ptr<Memo> memo;
+    if (memoized) {
+      memo = std::make_shared<Memo>();
+    }
+    auto func = Function{params, body, m_chunk.source, std::move(code),
+                         std::move(memo), std::make_shared<Jit>()};
+    emit(OpCode::Defn,
+         constant({Node::Symbol, Variable{Variable::Function, name, func}}));
+  }
+
+  // The expression is never in tail position, so that its calls all return
+  // before the form closes
+  void profile_form(const Expr &expr) {
+    emit(OpCode::Profile, 1);
+    expression(expr.items[1]);
+    emit(OpCode::Profile, 0);
+  }
+
+  // A form in tail position is the last thing its function does, so a call
+  // there can reuse the caller's frame
+  void form(const Expr &expr, bool tail) {
+    const auto &head = expr.head().node;
+
+    if (head.type == Node::Keyword) {
+      switch (head.as<Keyword>()) {
+      case Keyword::If:
+        return if_form(expr, tail);
+      case Keyword::Defn:
+        return defn_form(expr, false);
+      case Keyword::DefnMemo:
+        return defn_form(expr, true);
+      case Keyword::Profile:
+        return profile_form(expr);
+      default:
+        break;
+      }
+    }
+
+    // Builtins are checked against their table entry once, here
+    const Builtin *native = nullptr;
+    std::optional<std::size_t> index;
+    if (head.type == Node::Operator) {
+      native = &operator_builtin(head.as<char>());
+    } else if (head.type == Node::Global &&
+               (index = find_builtin(head.as<SymbolId>()))) {
+      native = &builtin(*index);
+    }
+
+    auto argc = arguments(expr.args(), native);
+
+    switch (head.type) {
+    case Node::Operator:
+      emit(OpCode::Op, head.as<char>(), argc);
+      return;
+    case Node::Global:
+      if (index) {
+        emit(OpCode::Native, *index, argc);
+        return;
+      }
+      emit(tail ? OpCode::TailCall : OpCode::Call, head.as<SymbolId>(), argc);
+      return;
+    case Node::Local:
+      if (argc == 0) {
+        emit(OpCode::Local, head.as<int>());
+        return;
+      }
+      break;
+    case Node::Number:
+    case Node::Bool:
+      if (argc == 0) {
+        emit(OpCode::Const, constant(head));
+        return;
+      }
+      break;
+    default:
+      break;
+    }
+
+    emit(OpCode::Apply, constant(head), argc);
+  }
+
+public:
+  explicit Compiler(Chunk &chunk) : m_chunk(chunk) {}
+
+  // Errors found while compiling are reported at the innermost expression
+  // they were found in, like the ones raised when the code runs
+  void expression(const Expr &expr, bool tail = false) {
+    auto outer = std::exchange(m_span, expr.span);
+    try {
+      if (expr.is_form()) {
+        form(expr, tail);
+      } else if (expr.node.type == Node::Local) {
+        emit(OpCode::Local, expr.node.as<int>());
+      } else {
+        emit(OpCode::Const, constant(expr.node));
+      }
+    } catch (...) {
+      rethrow_at(expr.span, m_chunk.source);
+    }
+    m_span = outer;
+  }
+
+  // Every expression is evaluated, but only the last one's value is kept
+  void program(const std::vector<Expr> &exprs) {
+    if (exprs.empty()) {
+      emit(OpCode::Const, constant({}));
+    }
+    for (std::size_t i = 0; i < exprs.size(); i++) {
+      if (i > 0) {
+        emit(OpCode::Pop);
+      }
+      expression(exprs[i]);
+    }
+    emit(OpCode::Return);
+  }
+
+  // The body of a function, which returns its value
+  void function(const Expr &body) {
+    m_span = body.span;
+    expression(body, true);
+    emit(OpCode::Return);
+  }
+};
+
+} // namespace
+
+std::shared_ptr<const Chunk> compile_chunk(const Program &program) {
+  auto chunk = std::make_shared<Chunk>();
+  chunk->source = program.source;
+  Compiler compiler{*chunk};
+  compiler.program(program.exprs);
+  return chunk;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "expr.hpp"
+#include "node.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class OpCode : std::uint8_t {
+  Const,       // push constants[arg]
+  Local,       // push the parameter referenced by the packed local in arg
+  Pop,         // discard the top of the stack
+  Op,          // apply operator (char)arg to the top argc values
+  Call,        // call global symbol arg with the top argc values
+  Native,      // call builtin arg (see core.hpp) with the top argc values
+  TailCall,    // like Call, but reuses the current frame for user functions
+  Apply,       // collapse constants[arg] with the top argc values
+  Defn,        // bind the function prototype in constants[arg]
+  JumpIfFalse, // pop a bool and jump to arg when it is false
+  Jump,        // jump to arg
+  Return,      // leave the chunk with the top of the stack
+  Profile,     // open a (profile expr) form when arg is 1, close it when 0
+};
+
+struct Instruction {
+  OpCode op;
+  std::uint16_t argc;
+  std::uint32_t arg;
+};
+
+struct Function;
+struct Variable;
+
+// What the global named by a Call or TailCall resolved to in one
+// interpreter, valid for as long as that interpreter's definition epoch stays
+// the same. All three are null when the callee is not a compiled user
+// function.
+struct CallCache {
+  std::uint64_t epoch = 0;
+  const Variable *sym = nullptr;
+  const Function *func = nullptr;
+  // The interpreter's caches for the calls in func's chunk
+  CallCache *callee_caches = nullptr;
+};
+
+struct Chunk {
+  std::vector<Instruction> code;
+  std::vector<Node> constants;
+  // The span of the expression each instruction was compiled from, which an
+  // error the instruction raises is reported at, and the source it is in
+  std::vector<Span> spans;
+  std::shared_ptr<const SourceMap> source;
+};
+
+// Compiles a resolved program (as produced by Interpreter::compile) into a
+// chunk that leaves the value of the last top-level expression on the stack.
+// A literal argument that a builtin can never accept is an EvalError now
+// rather than when the call runs.
+std::shared_ptr<const Chunk> compile_chunk(const Program &program);
@@ -0,0 +1,278 @@
+#include "expr.hpp"
+#include "fold.hpp"
+#include "interpreter.hpp"
+#include "list.hpp"
+#include "node.hpp"
+#include "parser.hpp"
+#include "symbol.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Scope = std::vector<SymbolId>;
+
+// Forms nested deeper than this are rejected. Compiling, folding and running
+// a form all recurse into the forms inside it, and this is as deep as the
+// walker goes for the forms of a single expression (see MaxWalkDepth).
+constexpr std::size_t MaxDepth = 4096;
+
+Span span_of(const Token &t) {
+  return {(std::uint32_t)t.offset, (std::uint32_t)t.length};
+}
+
+// Span from the start of first to the end of last
+Span span_of(const Token &first, const Token &last) {
+  return Span::cover(span_of(first), span_of(last));
+}
+
+// Builds the expression tree of a program from its tokens in a single pass of
+// recursive descent, recording the span of source each expression came from.
+// Identifiers are resolved as they are read into either a Node::Local (frame
+// depth and slot of a defn parameter) or a Node::Global (the symbol's slot in
+// the global table), and each form is folded as soon as it is closed. Names
+// being defined and parameter lists are left as plain identifiers.
+class Compiler {
+private:
+  std::span<const Token> m_tokens;
+  std::size_t m_pos = 0;
+  // How many forms are open at m_pos
+  std::size_t m_depth = 0;
+  Folder m_folder;
+  // The parameters of every defn whose body is being compiled, innermost last
+  std::vector<Scope> m_scopes;
+
+  bool at_paren(char c) const {
+    return m_pos < m_tokens.size() && m_tokens[m_pos].type == Token::Paren &&
+           m_tokens[m_pos].as<char>() == c;
+  }
+
+  [[noreturn]] void error(const char *message, const Token &at) const {
+    throw SyntaxError(message, at.offset);
+  }
+
+  Node identifier(SymbolId id) const {
+    for (std::size_t depth = 0; depth < m_scopes.size(); depth++) {
+      const auto &scope = m_scopes[m_scopes.size() - 1 - depth];
+      for (std::size_t slot = 0; slot < scope.size(); slot++) {
+        if (scope[slot] == id) {
+          return Node::local(depth, slot);
+        }
+      }
+    }
+    return {Node::Global, id};
+  }
+
+  Expr expression() {
+    const auto &t = m_tokens[m_pos];
+    switch (t.type) {
+    case Token::Paren:
+      if (t.as<char>() == ')') {
+        error("Unexpected ')'", t);
+      }
+      return form();
+    case Token::Bracket:
+      return vector();
+    case Token::Quote:
+      return quoted();
+    case Token::Operator:
+      ++m_pos;
+      return {{Node::Operator, t.as<char>()}, {}, span_of(t)};
+    case Token::Number:
+      ++m_pos;
+      return {{Node::Number, t.value}, {}, span_of(t)};
+    case Token::Bool:
+      ++m_pos;
+      return {{Node::Bool, t.as<bool>()}, {}, span_of(t)};
+    case Token::Keyword:
+      error("Only a form can start with a keyword", t);
+    case Token::Identifier:
+      ++m_pos;
+      return {identifier(t.as<SymbolId>()), {}, span_of(t)};
+    }
+    error("Unexpected token", t);
+  }
+
+  // The name a def or defn defines, which is left unresolved
+  Expr name() {
+    const auto &t = m_tokens[m_pos];
+    if (t.type != Token::Identifier) {
+      return expression();
+    }
+    ++m_pos;
+    return {{Node::Identifier, t.as<SymbolId>()}, {}, span_of(t)};
+  }
+
+  // The items of a form up to the paren that closes it. The body of a defn
+  // is compiled in the scope of its parameters.
+  Expr form() {
+    const auto &open = m_tokens[m_pos++];
+    if (++m_depth > MaxDepth) {
+      error("Too deeply nested", open);
+    }
+    Expr expr;
+    std::optional<Keyword> keyword;
+
+    while (true) {
+      if (m_pos >= m_tokens.size()) {
+        error("Expected ')'", open);
+      }
+      if (at_paren(')')) {
+        break;
+      }
+      const auto &t = m_tokens[m_pos];
+      auto index = expr.items.size();
+      bool defn = keyword == Keyword::Defn || keyword == Keyword::DefnMemo;
+      if (index == 0 && t.type == Token::Paren) {
+        error("Forms cannot start with a form", t);
+      }
+      if (index == 0 && t.type == Token::Keyword) {
+        keyword = t.as<Keyword>();
+        expr.items.push_back({{Node::Keyword, *keyword}, {}, span_of(t)});
+        ++m_pos;
+      } else if (index == 1 && (keyword == Keyword::Def || defn)) {
+        expr.items.push_back(name());
+      } else if (index == 3 && defn &&
+                 expr.items[2].node.type == Node::Vec) {
+        expr.items.push_back(body(expr.items[2]));
+      } else {
+        expr.items.push_back(expression());
+      }
+    }
+
+    const auto &close = m_tokens[m_pos++];
+    --m_depth;
+    if (expr.items.empty()) {
+      error("Forms cannot be empty", open);
+    }
+    expr.span = span_of(open, close);
+    if (keyword) {
+      check(expr, *keyword, open);
+    }
+    m_folder.form(expr);
+    return expr;
+  }
+
+  // Keyword forms other than def have to have the shape that the VM and the
+  // walker expect of them
+  void check(const Expr &expr, Keyword keyword, const Token &open) const {
+    switch (keyword) {
+    case Keyword::Defn:
+    case Keyword::DefnMemo:
+      if (expr.items.size() != 4 ||
+          expr.items[1].node.type != Node::Identifier ||
+          expr.items[2].node.type != Node::Vec) {
+        error("defn requires a name, a parameter vector and a body", open);
+      }
+      break;
+    case Keyword::If:
+      if (expr.items.size() != 4) {
+        error("if requires a condition and two branches", open);
+      }
+      break;
+    case Keyword::Profile:
+      if (expr.items.size() != 2) {
+        error("profile requires one expression", open);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  Expr body(const Expr &params) {
+    Scope scope;
+    for (const auto &p : params.node.as<Vector>()) {
+      if (p.type != Node::Identifier) {
+        throw SyntaxError("Parameters have to be names", params.span.offset);
+      }
+      scope.push_back(p.as<SymbolId>());
+    }
+    m_scopes.push_back(std::move(scope));
+    auto expr = expression();
+    m_scopes.pop_back();
+    return expr;
+  }
+
+  Expr vector() {
+    const auto &open = m_tokens[m_pos++];
+    if (open.as<char>() != '[') {
+      error("Unexpected ']'", open);
+    }
+    Vector vec;
+    while (true) {
+      if (m_pos >= m_tokens.size()) {
+        error("Expected ']'", open);
+      }
+      const auto &t = m_tokens[m_pos++];
+      if (t.type == Token::Bracket) {
+        if (t.as<char>() != ']') {
+          error("Vectors cannot be nested", t);
+        }
+        return {{Node::Vec, std::move(vec)}, {}, span_of(open, t)};
+      }
+      vec.add_element(t);
+    }
+  }
+
+  // '(1 2 3) is a list, and nothing else can be quoted
+  Expr quoted() {
+    const auto &quote = m_tokens[m_pos++];
+    if (!at_paren('(')) {
+      error("Only lists can be quoted", quote);
+    }
+    ++m_pos;
+
+    // Built front to back so the cells end up in order in the pool
+    Ref<List> list;
+    List *curr = nullptr;
+    while (!at_paren(')')) {
+      if (m_pos >= m_tokens.size()) {
+        error("Expected ')'", quote);
+      }
+      const auto &t = m_tokens[m_pos++];
+      if (t.type != Token::Number) {
+        error("Quoted lists can only hold numbers", t);
+      }
+      auto *cell = new List(t.value);
+      if (curr == nullptr) {
+        list = Ref<List>(cell);
+      } else {
+        curr->next = Ref<List>(cell);
+      }
+      curr = cell;
+    }
+    if (curr == nullptr) {
+      error("Quoted lists cannot be empty", quote);
+    }
+    const auto &close = m_tokens[m_pos++];
+
+    return {{Node::List, list.get()}, {}, span_of(quote, close)};
+  }
+
+public:
+  Compiler(Interpreter &ctx, std::span<const Token> tokens)
+      : m_tokens(tokens), m_folder(ctx) {}
+
+  std::vector<Expr> program() {
+    std::vector<Expr> exprs;
+    while (m_pos < m_tokens.size()) {
+      exprs.push_back(expression());
+    }
+    return exprs;
+  }
+};
+
+} // namespace
+
+Program Interpreter::compile(std::span<const Token> tokens,
+                             std::shared_ptr<const SourceMap> source) {
+  Compiler compiler{*this, tokens};
+  return {compiler.program(), std::move(source)};
+}
@@ -1,212 +1,490 @@
 #include "core.hpp"
+#include "expr.hpp"
+#include "heap.hpp"
 #include "interpreter.hpp"
 #include "list.hpp"
+#include "memo.hpp"
 #include "node.hpp"
+#include "number.hpp"
+#include "pool.hpp"
+#include "seq.hpp"
+#include "symbol.hpp"
 #include "variable.hpp"
 
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+// Below this many elements the parallel builtins are not worth the threads
+constexpr std::size_t ParallelMin = 1024;
+
+bool pure_body(const Interpreter &ctx, const Expr &body,
+               std::unordered_set<SymbolId> &seen);
+
+// A function is pure when calling it cannot define anything or observe
+// state other than its arguments, so that it can run on any thread
+bool pure_function(const Interpreter &ctx, SymbolId id,
+                   std::unordered_set<SymbolId> &seen) {
+  if (!seen.insert(id).second) {
+    return true;
+  }
+
+  const auto *fn = ctx.get_symbol(id);
+  if (fn == nullptr) {
+    return false;
+  }
+  switch (fn->type) {
+  case Variable::NativeFn:
+    return builtin(fn->as<int>()).pure;
+  case Variable::Function:
+    return pure_body(ctx, fn->as<Function>().body, seen);
+  default:
+    return true;
+  }
+}
+
+bool pure_body(const Interpreter &ctx, const Expr &body,
+               std::unordered_set<SymbolId> &seen) {
+  switch (body.node.type) {
+  case Node::Keyword:
+    if (body.node.as<Keyword>() != Keyword::If) {
+      return false;
+    }
+    break;
+  case Node::Global:
+    if (!pure_function(ctx, body.node.as<SymbolId>(), seen)) {
+      return false;
+    }
+    break;
+  default:
+    break;
+  }
+  for (const auto &item : body.items) {
+    if (!pure_body(ctx, item, seen)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether a builtin over vec may fan fn out over the work pool
+bool parallel(const Interpreter &ctx, const Node &fn, const Vector &vec) {
+  if (vec.size() < ParallelMin || WorkPool::in_worker() ||
+      WorkPool::instance().workers() < 2) {
+    return false;
+  }
+  if (fn.type == Node::Operator) {
+    return true;
+  }
+  const auto *var = ctx.get_symbol(fn.as<SymbolId>());
+  if (var == nullptr || !var->is_function()) {
+    return false;
+  }
+  std::unordered_set<SymbolId> seen;
+  return pure_function(ctx, fn.as<SymbolId>(), seen);
+}
+
+std::vector<Interpreter> fork_workers(const Interpreter &ctx) {
+  std::vector<Interpreter> workers;
+  for (std::size_t i = 1; i < WorkPool::instance().workers(); i++) {
+    workers.push_back(ctx.fork());
+  }
+  return workers;
+}
+
+// Worker 0 is the calling thread, which keeps using its own context
+Interpreter &worker_ctx(Interpreter &ctx, std::vector<Interpreter> &workers,
+                        std::size_t worker) {
+  return worker == 0 ? ctx : workers[worker - 1];
+}
+
+// Operators can be passed wherever a function of numbers is expected
+void expect_function(const Interpreter &ctx, const Node &fn,
+                     const char *error) {
+  if (fn.type == Node::Operator) {
+    return;
+  }
+  const auto *var = ctx.get_symbol(fn.as<SymbolId>());
+  if (var == nullptr || !var->is_function()) {
+    throw std::runtime_error(error);
+  }
+}
+
+// The sequence a lazy builtin adds its stage to
+Seq lazy(const Node &node) {
+  if (node.type == Node::Seq) {
+    return node.as<Seq>();
+  }
+  return Seq::over(node.as<Vector>());
+}
+
+// The cache of the defn_memo function that fn names
+Memo &memo_of(const Interpreter &ctx, const Node &fn, const char *error) {
+  const auto *var = ctx.get_symbol(fn.as<SymbolId>());
+  if (var == nullptr || var->type != Variable::Function ||
+      var->as<Function>().memo == nullptr) {
+    throw std::runtime_error(error);
+  }
+  return *var->as<Function>().memo;
+}
+
+std::size_t grain(std::size_t count) {
+  return std::max<std::size_t>(64, count / (WorkPool::instance().workers() * 8));
+}
+
+} // namespace
 
 namespace Core {
 
 FN(add) {
-  int sum = 0;
-  for (auto &arg : args) {
-    auto ret = arg.get_if_or(Node::Number, ctx, eval_id);
-    sum += ret.as<int>();
+  Value sum = 0;
+  for (const auto &arg : args) {
+    sum = Num::add(sum, arg.value);
   }
-  return {Node::Number, sum};
+  return {Node::Number, std::move(sum)};
 }
 
 FN(multiply) {
-  int sum = 1;
-  for (auto &arg : args) {
-    auto ret = arg.get_if_or(Node::Number, ctx, eval_id);
-    sum *= ret.as<int>();
+  Value product = 1;
+  for (const auto &arg : args) {
+    product = Num::mul(product, arg.value);
   }
-  return {Node::Number, sum};
+  return {Node::Number, std::move(product)};
 }
 
 FN(minus) {
   // Negate
   if (args.size() == 1) {
-    auto ret = args[0].get_if_or(Node::Number, ctx, eval_id);
-    return {Node::Number, -(ret.as<int>())};
+    return {Node::Number, Num::neg(args[0].value)};
   }
 
-  // Minus
-  auto sum_node = args[1].get_if_or(Node::Number, ctx, eval_id);
-  auto other_node = args[0].get_if_or(Node::Number, ctx, eval_id);
-  int total = sum_node.as<int>() - other_node.as<int>();
-
-  return {Node::Number, total};
+  Value total = args[0].value;
+  for (std::size_t i = 1; i < args.size(); i++) {
+    total = Num::sub(total, args[i].value);
+  }
+  return {Node::Number, std::move(total)};
 }
 
 FN(divide) {
-  auto dividend = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto divisor = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
-
-  auto quotient = dividend / divisor;
-  return {Node::Number, quotient};
+  return {Node::Number, Num::div(args[0].value, args[1].value)};
 }
 
 FN(equals) {
-  auto left = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto right = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-
-  return {Node::Bool, left == right};
+  return {Node::Bool, Num::equal(args[0].value, args[1].value)};
 }
 
 FN(less_than) {
-  auto left = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto right = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-
-  return {Node::Bool, left < right};
+  return {Node::Bool, Num::less(args[0].value, args[1].value)};
 }
 
 FN(greater_than) {
-  auto left = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto right = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-
-  return {Node::Bool, left > right};
+  return {Node::Bool, Num::less(args[1].value, args[0].value)};
 }
 
-FN(sqrt) {
-  auto arg = args[0].get_if_or(Node::Number, ctx, eval_id);
-  return {Node::Number, (int)std::sqrt(arg.as<int>())};
-}
+FN(sqrt) { return {Node::Number, Num::sqrt(args[0].value)}; }
 
 FN(map) {
-  auto id = args[0].get_if(Node::Identifier).as<std::string>();
-  auto vec = args[1].get_if_or(Node::Vec, ctx, eval_id).as<Vector>();
-
-  auto fn = ctx.get_symbol(id);
-  if (!fn->is_function()) {
-    throw std::runtime_error("map requires a function");
-  }
+  expect_function(ctx, args[0], "map requires a function");
 
-  Vector nvec;
-  for (auto &el : vec.data) {
-    auto ret = collapse(ctx, args[0], {el});
-    nvec.data.push_back(ret);
-  }
-
-  return Node{Node::Vec, nvec};
+  return Node{Node::Seq, lazy(args[1]).then(Seq::Stage::Map, args[0])};
 }
 
 FN(range) {
-  auto first = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto last = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
-
-  Vector vec;
-  for (int i = first; i <= last; i++) {
-    vec.data.push_back({Node::Number, i});
-  }
-
-  return Node{Node::Vec, vec};
+  return Node{Node::Seq, Seq::range(Num::to_int(args[0].value),
+                                    Num::to_int(args[1].value))};
 }
 
 FN(size) {
-  auto vec = args[0].get_if_or(Node::Vec, ctx, eval_id).as<Vector>();
-  return Node{Node::Number, (int)vec.data.size()};
+  if (args[0].type == Node::Seq) {
+    return Node{Node::Number, (int)args[0].as<Seq>().size(ctx)};
+  }
+  return Node{Node::Number, (int)args[0].as<Vector>().size()};
 }
 
 FN(len) {
-  auto *list = args[0].get_if_or(Node::List, ctx, eval_id).as<::List *>();
   int count = 0;
-  auto *curr = list;
+  auto *curr = args[0].as<::List *>();
   while (curr != nullptr) {
     ++count;
-    curr = curr->next;
+    curr = curr->next.get();
   }
   return Node{Node::Number, count};
 }
 
-FN(head) {
-  auto *list = args[0].get_if_or(Node::List, ctx, eval_id).as<::List *>();
-  return Node{Node::Number, list->value};
-}
+FN(head) { return Node{Node::Number, args[0].as<::List *>()->value}; }
 
-FN(tail) {
-  auto list = args[0].get_if_or(Node::List, ctx, eval_id).as<::List *>();
-  return Node{Node::List, list->next};
-}
+FN(tail) { return Node{Node::List, args[0].as<::List *>()->next.get()}; }
 
 FN(nth) {
-  auto index = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto list = args[1].get_if_or(Node::List, ctx, eval_id).as<::List *>();
-  auto *curr = list;
-  for (int i = 0; i < index; i++) {
-    curr = curr->next;
+  auto index = Num::to_int(args[0].value);
+
+  if (args[1].type == Node::Seq) {
+    if (index < 0) {
+      throw std::runtime_error("Vector index out of range");
+    }
+    return args[1].as<Seq>().nth(ctx, index);
+  }
+
+  if (args[1].type == Node::Vec) {
+    return args[1].as<Vector>()[index];
+  }
+
+  auto *curr = args[1].as<::List *>();
+  for (int i = 0; i < index && curr != nullptr; i++) {
+    curr = curr->next.get();
+  }
+  if (curr == nullptr || index < 0) {
+    throw std::runtime_error("List index out of range");
   }
   return Node{Node::Number, curr->value};
 }
 
-FN(rem) {
-  auto dividend = args[0].get_if_or(Node::Number, ctx, eval_id).as<int>();
-  auto divisor = args[1].get_if_or(Node::Number, ctx, eval_id).as<int>();
+FN(rem) { return {Node::Number, Num::rem(args[0].value, args[1].value)}; }
+
+FN(filter) {
+  expect_function(ctx, args[0], "filter requires a function");
 
-  auto remainder = dividend % divisor;
-  return {Node::Number, remainder};
+  return Node{Node::Seq, lazy(args[1]).then(Seq::Stage::Filter, args[0])};
 }
 
-FN(filter) {
-  auto id = args[0].get_if(Node::Identifier).as<std::string>();
-  auto vec = args[1].get_if_or(Node::Vec, ctx, eval_id).as<Vector>();
+FN(reduce) {
+  expect_function(ctx, args[0], "reduce requires a function");
+  return lazy(args[1]).reduce(ctx, args[0]);
+}
 
-  auto fn = ctx.get_symbol(id);
-  if (!fn->is_function()) {
-    throw std::runtime_error("filter requires a function");
+FN(conj) {
+  auto vec = args[0].as<Vector>();
+  for (std::size_t i = 1; i < args.size(); i++) {
+    vec.push_back(std::move(args[i]));
+  }
+  return Node{Node::Vec, std::move(vec)};
+}
+
+FN(assoc) {
+  const auto &vec = args[0].as<Vector>();
+  return Node{Node::Vec, vec.assoc(Num::to_int(args[1].value), std::move(args[2]))};
+}
+
+FN(subvec) {
+  auto start = Num::to_int(args[1].value);
+  auto end = Num::to_int(args[2].value);
+  if (start < 0 || end < start) {
+    throw std::runtime_error("subvec requires 0 <= start <= end");
+  }
+  return Node{Node::Vec, args[0].as<Vector>().subvec(start, end)};
+}
+
+FN(concat) {
+  const auto &left = args[0].as<Vector>();
+  return Node{Node::Vec, left.concat(args[1].as<Vector>())};
+}
+
+FN(list_stats) {
+  auto stats = list_pool_stats();
+  Vector vec;
+  vec.push_back({Node::Number, (int)stats.live});
+  vec.push_back({Node::Number, (int)stats.free});
+  vec.push_back({Node::Number, (int)stats.slabs});
+  vec.push_back({Node::Number, (int)stats.allocations});
+  return Node{Node::Vec, std::move(vec)};
+}
+
+FN(gc_stats) {
+  auto stats = heap_stats();
+  Vector vec;
+  vec.push_back({Node::Number, Num::from((std::int64_t)stats.live_bytes)});
+  vec.push_back({Node::Number, Num::from((std::int64_t)stats.live_objects)});
+  vec.push_back({Node::Number, Num::from((std::int64_t)stats.allocations)});
+  vec.push_back({Node::Number, Num::from((std::int64_t)stats.frees)});
+  vec.push_back({Node::Number, Num::from((std::int64_t)stats.limit)});
+  return Node{Node::Vec, std::move(vec)};
+}
+
+FN(heap_limit) {
+  auto kind = Num::kind(args[0].value);
+  if (kind == Num::Float) {
+    throw std::runtime_error("heap_limit requires a whole number of bytes");
+  }
+  if (Num::less(args[0].value, 0)) {
+    throw std::runtime_error("heap_limit requires a size of at least 0 bytes");
+  }
+  // Any bignum that is not negative is past what gc_stats can report
+  if (kind == Num::Big) {
+    throw std::runtime_error(
+        "heap_limit requires a size of at most " +
+        std::to_string(std::numeric_limits<std::int64_t>::max()) + " bytes");
+  }
+  auto bytes = kind == Num::Small ? args[0].as<int>()
+                                  : args[0].as<Int64>().value;
+  set_heap_limit(bytes);
+  return args[0];
+}
+
+FN(pmap) {
+  expect_function(ctx, args[0], "pmap requires a function");
+  const auto &vec = args[1].as<Vector>();
+
+  if (!parallel(ctx, args[0], vec)) {
+    return map(ctx, args);
+  }
+
+  auto workers = fork_workers(ctx);
+  std::vector<Node> results(vec.size());
+  auto body = [&](std::size_t worker, std::size_t begin, std::size_t end) {
+    auto &wctx = worker_ctx(ctx, workers, worker);
+    for (auto i = begin; i < end; i++) {
+      Node arg[] = {vec[i]};
+      results[i] = collapse(wctx, args[0], arg);
+    }
+  };
+  if (!WorkPool::instance().run(vec.size(), grain(vec.size()), body)) {
+    return map(ctx, args);
   }
 
   Vector nvec;
-  for (auto &el : vec.data) {
-    auto ret = collapse(ctx, args[0], {el}).get_if(Node::Bool);
-    if (ret.as<bool>()) {
-      nvec.data.push_back(el);
+  for (auto &result : results) {
+    nvec.push_back(std::move(result));
+  }
+  return Node{Node::Vec, std::move(nvec)};
+}
+
+FN(pfilter) {
+  expect_function(ctx, args[0], "pfilter requires a function");
+  const auto &vec = args[1].as<Vector>();
+
+  if (!parallel(ctx, args[0], vec)) {
+    return filter(ctx, args);
+  }
+
+  auto workers = fork_workers(ctx);
+  std::vector<char> keep(vec.size());
+  auto body = [&](std::size_t worker, std::size_t begin, std::size_t end) {
+    auto &wctx = worker_ctx(ctx, workers, worker);
+    for (auto i = begin; i < end; i++) {
+      Node arg[] = {vec[i]};
+      auto ret = collapse(wctx, args[0], arg).get_if(Node::Bool);
+      keep[i] = ret.as<bool>();
     }
+  };
+  if (!WorkPool::instance().run(vec.size(), grain(vec.size()), body)) {
+    return filter(ctx, args);
   }
 
-  return Node{Node::Vec, nvec};
+  Vector nvec;
+  for (std::size_t i = 0; i < vec.size(); i++) {
+    if (keep[i]) {
+      nvec.push_back(vec[i]);
+    }
+  }
+  return Node{Node::Vec, std::move(nvec)};
 }
 
-FN(reduce) {
-  auto id = args[0].get_if(Node::Identifier).as<std::string>();
-  auto vec = args[1].get_if_or(Node::Vec, ctx, eval_id).as<Vector>();
+// Calling preduce declares op associative: every slice of the vector is
+// folded on its own and the partial results are then combined pairwise, which
+// gives the same answer as a left fold only because of that
+FN(preduce) {
+  expect_function(ctx, args[0], "preduce requires a function");
+  const auto &vec = args[1].as<Vector>();
 
-  auto fn = ctx.get_symbol(id);
-  if (!fn->is_function()) {
-    throw std::runtime_error("reduce requires a function");
+  if (!parallel(ctx, args[0], vec)) {
+    return reduce(ctx, args);
   }
 
-  int value = vec.data[0].as<int>();
-  for (int i = 1; i < (int)vec.data.size(); i++) {
-    auto ret = collapse(ctx, args[0], {Node{Node::Number, value}, vec.data[i]});
-    value = ret.as<int>();
+  auto workers = fork_workers(ctx);
+  auto slices = WorkPool::instance().workers() * 4;
+  auto slice = (vec.size() + slices - 1) / slices;
+  std::vector<Node> partials((vec.size() + slice - 1) / slice);
+
+  auto body = [&](std::size_t worker, std::size_t begin, std::size_t end) {
+    auto &wctx = worker_ctx(ctx, workers, worker);
+    for (auto s = begin; s < end; s++) {
+      auto first = s * slice;
+      auto last = std::min(vec.size(), first + slice);
+      Node value = vec[first];
+      for (auto i = first + 1; i < last; i++) {
+        Node pair[] = {std::move(value), vec[i]};
+        value = collapse(wctx, args[0], pair);
+      }
+      partials[s] = std::move(value);
+    }
+  };
+  if (!WorkPool::instance().run(partials.size(), 1, body)) {
+    return reduce(ctx, args);
   }
 
-  return Node{Node::Number, value};
+  while (partials.size() > 1) {
+    std::vector<Node> next;
+    for (std::size_t i = 0; i + 1 < partials.size(); i += 2) {
+      Node pair[] = {std::move(partials[i]), std::move(partials[i + 1])};
+      next.push_back(collapse(ctx, args[0], pair));
+    }
+    if (partials.size() % 2 == 1) {
+      next.push_back(std::move(partials.back()));
+    }
+    partials = std::move(next);
+  }
+
+  return std::move(partials[0]);
+}
+
+FN(memo_stats) {
+  auto stats =
+      memo_of(ctx, args[0], "memo_stats requires a defn_memo function").stats();
+  Vector vec;
+  vec.push_back({Node::Number, (int)stats.hits});
+  vec.push_back({Node::Number, (int)stats.misses});
+  vec.push_back({Node::Number, (int)stats.size});
+  vec.push_back({Node::Number, (int)stats.capacity});
+  return Node{Node::Vec, std::move(vec)};
+}
+
+FN(memo_limit) {
+  auto &memo = memo_of(ctx, args[0], "memo_limit requires a defn_memo function");
+  auto capacity = Num::to_int(args[1].value);
+  if (capacity < 0) {
+    throw std::runtime_error("memo_limit requires a size of at least 0");
+  }
+  memo.set_capacity(capacity);
+  return args[1];
 }
 
 Node eval_id(Interpreter &ctx, Node node, Node::Type expected) {
-  if (node.type == Node::Identifier) {
-    auto val = ctx.get_symbol(node.as<std::string>());
-    if (!val.has_value()) {
+  if (node.type == Node::Seq && expected == Node::Vec) {
+    return Node{Node::Vec, node.as<Seq>().realize(ctx)};
+  }
+  if (node.type == Node::Local) {
+    const auto &val = ctx.get_local(node);
+    if (val.type == expected) {
+      return val;
+    }
+  } else if (node.type == Node::Global) {
+    const auto *val = ctx.get_symbol(node.as<SymbolId>());
+    if (val == nullptr) {
       return Node{Node::Undefined};
     }
     switch (val->type) {
     case Variable::Integer:
       if (expected == Node::Number)
-        return Node{Node::Number, val->as<int>()};
+        return Node{Node::Number, val->value};
+      break;
     case Variable::Vec:
       if (expected == Node::Vec)
-        return Node{Node::Vec, val->as<Vector>()};
+        return Node{Node::Vec, val->value};
+      break;
     case Variable::List:
       if (expected == Node::List)
-        return Node{Node::List, val->as<::List *>()};
+        return Node{Node::List, val->value};
+      break;
     case Variable::Bool:
       if (expected == Node::Bool)
-        return Node{Node::Bool, val->as<bool>()};
+        return Node{Node::Bool, val->value};
+      break;
     default:
       break;
     }
@@ -215,3 +493,116 @@ Node eval_id(Interpreter &ctx, Node node, Node::Type expected) {
 }
 
 } // namespace Core
+
+namespace {
+
+constexpr auto V = Builtin::Variadic;
+constexpr auto Number = Arg::Number;
+constexpr auto Sequence = Arg::Vec | Arg::Seq;
+constexpr auto Global = Arg::of(Node::Global);
+
+constexpr Builtin operators[] = {
+    {"+", Core::add, 0, V, {Number, Number, Number}},
+    {"*", Core::multiply, 0, V, {Number, Number, Number}},
+    {"-", Core::minus, 1, V, {Number, Number, Number}},
+    {"/", Core::divide, 2, 2, {Number, Number}},
+    {"=", Core::equals, 2, 2, {Number, Number}},
+    {"<", Core::less_than, 2, 2, {Number, Number}},
+    {">", Core::greater_than, 2, 2, {Number, Number}},
+};
+
+constexpr Builtin builtins[] = {
+    {"sqrt", Core::sqrt, 1, 1, {Number}},
+    {"map", Core::map, 2, 2, {Arg::Fn, Sequence}},
+    {"range", Core::range, 2, 2, {Number, Number}},
+    {"size", Core::size, 1, 1, {Sequence}},
+    {"len", Core::len, 1, 1, {Arg::List}},
+    {"head", Core::head, 1, 1, {Arg::List}},
+    {"tail", Core::tail, 1, 1, {Arg::List}},
+    {"nth", Core::nth, 2, 2, {Number, Sequence | Arg::List}},
+    {"rem", Core::rem, 2, 2, {Number, Number}},
+    {"filter", Core::filter, 2, 2, {Arg::Fn, Sequence}},
+    {"reduce", Core::reduce, 2, 2, {Arg::Fn, Sequence}},
+    {"conj", Core::conj, 1, V, {Arg::Vec, Number, Number}},
+    {"assoc", Core::assoc, 3, 3, {Arg::Vec, Number, Number}},
+    {"subvec", Core::subvec, 3, 3, {Arg::Vec, Number, Number}},
+    {"concat", Core::concat, 2, 2, {Arg::Vec, Arg::Vec}},
+    {"list_stats", Core::list_stats, 0, 0, {}, false},
+    {"gc_stats", Core::gc_stats, 0, 0, {}, false},
+    {"heap_limit", Core::heap_limit, 1, 1, {Number}, false},
+    {"pmap", Core::pmap, 2, 2, {Arg::Fn, Arg::Vec}},
+    {"pfilter", Core::pfilter, 2, 2, {Arg::Fn, Arg::Vec}},
+    {"preduce", Core::preduce, 2, 2, {Arg::Fn, Arg::Vec}},
+    {"memo_stats", Core::memo_stats, 1, 1, {Global}, false},
+    {"memo_limit", Core::memo_limit, 2, 2, {Global, Number}, false},
+};
+
+// A parameter or global stands in for the value it holds, and a lazy sequence
+// for the vector it realizes
+bool convert(Interpreter &ctx, Node &arg, std::uint32_t accepted) {
+  for (auto type : {Node::Number, Node::Vec, Node::List}) {
+    if (accepted & Arg::of(type)) {
+      auto node = Core::eval_id(ctx, arg, type);
+      if (node.type != Node::Undefined) {
+        arg = std::move(node);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void Builtin::check_arity(std::size_t argc) const {
+  if (argc < min_args) {
+    throw std::runtime_error("Too few arguments to " + std::string(name));
+  }
+  if (max_args != Variadic && argc > max_args) {
+    throw std::runtime_error("Too many arguments to " + std::string(name));
+  }
+}
+
+void Builtin::wrong_type(std::size_t i) const {
+  throw std::runtime_error("Wrong type of argument " + std::to_string(i + 1) +
+                           " to " + std::string(name));
+}
+
+Node Builtin::call(Interpreter &ctx, std::span<Node> args) const {
+  for (std::size_t i = 0; i < args.size(); i++) {
+    if (!accepts(i, args[i]) && !convert(ctx, args[i], type_at(i))) {
+      wrong_type(i);
+    }
+  }
+  return fn(ctx, args);
+}
+
+const Builtin &builtin(std::size_t index) { return builtins[index]; }
+
+std::size_t builtin_count() { return std::size(builtins); }
+
+std::optional<std::size_t> find_builtin(SymbolId name) {
+  static const auto ids = [] {
+    std::vector<SymbolId> ids;
+    for (const auto &b : builtins) {
+      ids.push_back(intern(b.name));
+    }
+    return ids;
+  }();
+
+  for (std::size_t i = 0; i < ids.size(); i++) {
+    if (ids[i] == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+const Builtin &operator_builtin(char op) {
+  for (const auto &b : operators) {
+    if (b.name[0] == op) {
+      return b;
+    }
+  }
+  throw std::runtime_error("Unknown operator");
+}
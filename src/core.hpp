@@ -1,9 +1,16 @@
 #pragma once
 
 #include "node.hpp"
-#include <vector>
+#include "symbol.hpp"
 
-#define FN(x) Node x(Interpreter &ctx, std::vector<Node> args)
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+
+// Builtins get their arguments in source order, already converted to the
+// types their table entry declares (see Builtin below)
+#define FN(x) Node x(Interpreter &ctx, std::span<Node> args)
 
 class Interpreter;
 
@@ -30,8 +37,67 @@ FN(nth);
 FN(rem);
 FN(filter);
 FN(reduce);
+FN(conj);
+FN(assoc);
+FN(subvec);
+FN(concat);
+FN(list_stats);
+FN(gc_stats);
+FN(heap_limit);
+FN(pmap);
+FN(pfilter);
+FN(preduce);
+FN(memo_stats);
+FN(memo_limit);
 
 // Helper funcs
 Node eval_id(Interpreter &ctx, Node node, Node::Type expected);
 
 } // namespace Core
+
+// The node types a builtin accepts in one argument position
+namespace Arg {
+constexpr std::uint32_t of(Node::Type type) { return 1u << type; }
+
+constexpr auto Number = of(Node::Number);
+constexpr auto Vec = of(Node::Vec);
+constexpr auto List = of(Node::List);
+constexpr auto Seq = of(Node::Seq);
+// A function: an operator, or a global naming a defn or builtin
+constexpr auto Fn = of(Node::Operator) | of(Node::Global);
+} // namespace Arg
+
+struct Builtin {
+  using Fn = Node (*)(Interpreter &, std::span<Node>);
+  static constexpr std::uint8_t Variadic = 0xff;
+
+  std::string_view name;
+  Fn fn;
+  std::uint8_t min_args;
+  std::uint8_t max_args;
+  // Accepted types of the first arguments; the last one also covers any
+  // arguments after it
+  std::uint32_t types[3];
+  // Never defines anything or looks at state other than its arguments
+  bool pure = true;
+
+  std::uint32_t type_at(std::size_t i) const { return types[i < 2 ? i : 2]; }
+  bool accepts(std::size_t i, const Node &arg) const {
+    return type_at(i) & Arg::of(arg.type);
+  }
+
+  // Throws unless argc is within the declared arity
+  void check_arity(std::size_t argc) const;
+  [[noreturn]] void wrong_type(std::size_t i) const;
+  // Converts parameters and globals to the declared types before calling fn
+  Node call(Interpreter &ctx, std::span<Node> args) const;
+};
+
+// Builtins called by name, which a NativeFn variable refers to by index. Call
+// sites are bound to them when they are compiled, so the names cannot be
+// redefined.
+const Builtin &builtin(std::size_t index);
+std::size_t builtin_count();
+std::optional<std::size_t> find_builtin(SymbolId name);
+
+const Builtin &operator_builtin(char op);
@@ -0,0 +1,48 @@
+#include "expr.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+SourceMap::SourceMap(std::string name, std::string_view text)
+    : m_name(std::move(name)), m_lines{0} {
+  for (std::size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\n') {
+      m_lines.push_back(i + 1);
+    }
+  }
+}
+
+std::pair<std::size_t, std::size_t>
+SourceMap::position(std::size_t offset) const {
+  // The last line that starts at or before offset
+  auto line = std::upper_bound(m_lines.begin(), m_lines.end(), offset);
+  if (line == m_lines.begin()) {
+    return {1, offset + 1};
+  }
+  --line;
+  return {line - m_lines.begin() + 1, offset - *line + 1};
+}
+
+void Expr::print_debug(std::size_t depth) const {
+  if (!is_form()) {
+    node.print_debug(depth);
+    return;
+  }
+
+  for (std::size_t i = 0; i < depth; i++)
+    std::cout << " ";
+  std::cout << "FORM\t\t" << span.offset << "+" << span.length << std::endl;
+  for (const auto &item : items) {
+    item.print_debug(depth + 2);
+  }
+}
+
+void rethrow_at(Span span, const std::shared_ptr<const SourceMap> &source) {
+  try {
+    throw;
+  } catch (const EvalError &) {
+    throw;
+  } catch (const std::runtime_error &e) {
+    throw EvalError(e.what(), span, source);
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "node.hpp"
+#include "parser.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Where an expression came from, in bytes from the start of its source
+struct Span {
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;
+
+  std::uint32_t end() const { return offset + length; }
+  // The span from the start of first to the end of last
+  static Span cover(const Span &first, const Span &last) {
+    return {first.offset, last.end() - first.offset};
+  }
+};
+
+// What is kept of a source once it has been compiled, enough to turn the
+// spans of the code compiled from it into lines and columns long after the
+// text itself is gone
+class SourceMap {
+private:
+  std::string m_name;
+  // Offset of the first byte of every line, the first one at 0
+  std::vector<std::uint32_t> m_lines;
+
+public:
+  SourceMap(std::string name, std::string_view text);
+  SourceMap(std::string name, std::vector<std::uint32_t> lines)
+      : m_name(std::move(name)), m_lines(std::move(lines)) {}
+
+  const std::string &name() const { return m_name; }
+  const std::vector<std::uint32_t> &lines() const { return m_lines; }
+
+  // Line and column of offset, both counted from 1
+  std::pair<std::size_t, std::size_t> position(std::size_t offset) const;
+};
+
+// A node of the tree a program is compiled to (see Interpreter::compile). A
+// form holds its head and arguments as items, in order, and an atom holds its
+// resolved value in node. Forms are never empty, and their head is always an
+// atom.
+struct Expr {
+  Node node;
+  std::vector<Expr> items;
+  Span span;
+
+  bool is_form() const { return !items.empty(); }
+  const Expr &head() const { return items.front(); }
+  std::span<const Expr> args() const {
+    return std::span<const Expr>(items).subspan(1);
+  }
+
+  // (keyword ...)
+  bool is_keyword(Keyword keyword) const {
+    return is_form() && head().node.type == Node::Keyword &&
+           head().node.as<Keyword>() == keyword;
+  }
+
+  void print_debug(std::size_t depth = 0) const;
+};
+
+// The top-level expressions of a compiled program, and the source their spans
+// point into when it is known
+struct Program {
+  std::vector<Expr> exprs;
+  std::shared_ptr<const SourceMap> source;
+};
+
+// An error raised while a program ran, and the innermost expression that was
+// being evaluated when it was. The source is null when the code came from
+// somewhere that has none, like the REPL.
+struct EvalError : std::runtime_error {
+  Span span;
+  std::shared_ptr<const SourceMap> source;
+
+  EvalError(const std::string &message, Span _span,
+            std::shared_ptr<const SourceMap> _source)
+      : std::runtime_error(message), span(_span), source(std::move(_source)) {}
+};
+
+// Rethrows the exception being handled as an EvalError at span, unless it
+// already is one, in which case an expression inside this one raised it
+[[noreturn]] void rethrow_at(Span span,
+                             const std::shared_ptr<const SourceMap> &source);
@@ -0,0 +1,170 @@
+#include "fold.hpp"
+#include "core.hpp"
+#include "interpreter.hpp"
+#include "number.hpp"
+#include "parser.hpp"
+#include "seq.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Longest lazy sequence that is realized into a vector literal
+constexpr std::size_t MaxRealized = 64;
+
+// A value that stands for itself wherever it appears
+bool is_literal(const Node &node) {
+  switch (node.type) {
+  case Node::Number:
+  case Node::Bool:
+  case Node::List:
+    return true;
+  case Node::Vec:
+    for (const auto &el : node.as<Vector>()) {
+      if (el.type != Node::Number) {
+        return false;
+      }
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::optional<Node> apply(Interpreter &ctx, const Builtin &native,
+                          std::vector<Node> args) {
+  if (!native.pure || args.size() < native.min_args ||
+      (native.max_args != Builtin::Variadic && args.size() > native.max_args)) {
+    return std::nullopt;
+  }
+  for (std::size_t i = 0; i < args.size(); i++) {
+    if (!native.accepts(i, args[i])) {
+      return std::nullopt;
+    }
+  }
+
+  Node result;
+  try {
+    result = native.call(ctx, args);
+  } catch (const std::runtime_error &) {
+    // Reported when (and if) the expression actually runs
+    return std::nullopt;
+  }
+
+  if (result.type == Node::Seq) {
+    const auto &seq = result.as<Seq>();
+    auto count = seq.source ? seq.source->size()
+                 : seq.last >= seq.first
+                     ? (std::size_t)(seq.last - seq.first + 1)
+                     : 0;
+    if (count > MaxRealized) {
+      return std::nullopt;
+    }
+    try {
+      result = Node{Node::Vec, seq.realize(ctx)};
+    } catch (const std::runtime_error &) {
+      return std::nullopt;
+    }
+  }
+
+  if (!is_literal(result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+} // namespace
+
+// (if cond then else) with a literal cond is the branch it takes
+bool Folder::if_form(Expr &form) {
+  const auto &cond = form.items[1];
+  if (cond.is_form() || cond.node.type != Node::Bool) {
+    return false;
+  }
+  auto branch = std::move(form.items[cond.node.as<bool>() ? 2 : 3]);
+  form = std::move(branch);
+  return true;
+}
+
+// Sums and products are evaluated left to right, so the literals they start
+// with can be combined ahead of time. A literal after an operand that is only
+// known when the form runs has to stay where it is: (+ x 1 2) adds 1 to x
+// before it adds 2, which rounds differently from adding 3 once x is a float.
+void Folder::combine_literals(Expr &form) {
+  char op = form.head().node.as<char>();
+  auto args = form.args();
+  std::size_t literals = 0;
+  Value value = op == '+' ? 0 : 1;
+  while (literals < args.size() && !args[literals].is_form() &&
+         args[literals].node.type == Node::Number) {
+    const auto &arg = args[literals].node;
+    value = op == '+' ? Num::add(value, arg.value) : Num::mul(value, arg.value);
+    ++literals;
+  }
+  // Some operand is not a literal, or the whole form would have been folded
+  if (literals < 2 || literals == args.size()) {
+    return;
+  }
+
+  auto first = form.items.begin() + 1;
+  auto span = Span::cover(first->span, first[literals - 1].span);
+  *first = {{Node::Number, std::move(value)}, {}, span};
+  form.items.erase(first + 1, first + literals);
+}
+
+// The forms inside form have already been folded as far as they go
+void Folder::form(Expr &form) {
+  const auto head = form.head().node;
+
+  if (head.type == Node::Keyword) {
+    if (head.as<Keyword>() == Keyword::If) {
+      if_form(form);
+    }
+    return;
+  }
+
+  // (5) is just 5
+  if (form.items.size() == 1 &&
+      (head.type == Node::Number || head.type == Node::Bool)) {
+    form = {head, {}, form.span};
+    return;
+  }
+
+  const Builtin *native = nullptr;
+  if (head.type == Node::Operator) {
+    native = &operator_builtin(head.as<char>());
+  } else if (head.type == Node::Global) {
+    if (auto index = find_builtin(head.as<SymbolId>())) {
+      native = &builtin(*index);
+    }
+  }
+  if (native == nullptr) {
+    return;
+  }
+
+  bool constant = true;
+  for (const auto &arg : form.args()) {
+    constant = constant && !arg.is_form() &&
+               (is_literal(arg.node) || arg.node.type == Node::Operator);
+  }
+
+  if (constant) {
+    std::vector<Node> values;
+    for (const auto &arg : form.args()) {
+      values.push_back(arg.node);
+    }
+    if (auto value = apply(m_ctx, *native, std::move(values))) {
+      form = {std::move(*value), {}, form.span};
+    }
+    return;
+  }
+
+  if (head.type == Node::Operator &&
+      (head.as<char>() == '+' || head.as<char>() == '*')) {
+    combine_literals(form);
+  }
+}
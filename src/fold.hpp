@@ -0,0 +1,27 @@
+#pragma once
+
+#include "expr.hpp"
+
+class Interpreter;
+
+// Evaluates, ahead of time, every part of a resolved program that only
+// depends on literals: operators and pure builtins applied to literals become
+// the value they return (ranges only when they are short), and an if whose
+// condition is a literal becomes the branch it takes. Inside the bodies of
+// functions this saves redoing the same work on every call.
+//
+// The compiler hands each form over as soon as it has built it, by which time
+// the forms inside it have already been folded as far as they go.
+class Folder {
+public:
+  explicit Folder(Interpreter &ctx) : m_ctx(ctx) {}
+
+  // Folds form in place, into an atom when it is constant
+  void form(Expr &form);
+
+private:
+  Interpreter &m_ctx;
+
+  bool if_form(Expr &form);
+  void combine_literals(Expr &form);
+};
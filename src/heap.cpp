@@ -0,0 +1,76 @@
+#include "heap.hpp"
+#include "value.hpp"
+
+#include <atomic>
+
+namespace {
+
+std::size_t s_live_bytes = 0;
+std::size_t s_live_objects = 0;
+std::uint64_t s_allocations = 0;
+std::uint64_t s_frees = 0;
+std::atomic<std::size_t> s_limit{0};
+
+// The same split as reference counts: plain while one thread owns the heap,
+// atomic while worker threads share it
+template <typename T> void add(T &counter, T amount) {
+  if (g_shared_heap) {
+    std::atomic_ref<T>(counter).fetch_add(amount, std::memory_order_relaxed);
+  } else {
+    counter += amount;
+  }
+}
+
+template <typename T> void sub(T &counter, T amount) {
+  if (g_shared_heap) {
+    std::atomic_ref<T>(counter).fetch_sub(amount, std::memory_order_relaxed);
+  } else {
+    counter -= amount;
+  }
+}
+
+template <typename T> T load(T &counter) {
+  return std::atomic_ref<T>(counter).load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+HeapStats heap_stats() {
+  return {load(s_live_bytes), load(s_live_objects), load(s_allocations),
+          load(s_frees), s_limit.load(std::memory_order_relaxed)};
+}
+
+void set_heap_limit(std::size_t bytes) {
+  s_limit.store(bytes, std::memory_order_relaxed);
+}
+
+void heap_reserve(std::size_t size) {
+  auto limit = s_limit.load(std::memory_order_relaxed);
+  if (limit != 0 && load(s_live_bytes) + size > limit) {
+    throw HeapLimitError();
+  }
+  add(s_live_bytes, size);
+  add<std::size_t>(s_live_objects, 1);
+  add<std::uint64_t>(s_allocations, 1);
+}
+
+void heap_release(std::size_t size) {
+  sub(s_live_bytes, size);
+  sub<std::size_t>(s_live_objects, 1);
+  add<std::uint64_t>(s_frees, 1);
+}
+
+void *heap_allocate(std::size_t size) {
+  heap_reserve(size);
+  try {
+    return ::operator new(size);
+  } catch (...) {
+    heap_release(size);
+    throw;
+  }
+}
+
+void heap_free(void *ptr, std::size_t size) {
+  heap_release(size);
+  ::operator delete(ptr, size);
+}
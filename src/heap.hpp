@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Accounting for the heap that values live on: list cells, vector nodes, and
+// the boxes of everything else (see HeapObject in value.hpp). Values are
+// reference counted and immutable, so a value can only refer to values that
+// already existed when it was made. They never form cycles, and each one is
+// freed as soon as the last reference to it goes away, which leaves nothing
+// for a tracing collector to find.
+//
+// Sizes are those of the objects themselves, not of buffers that a few of
+// them keep on the side (the digits of a bignum, the nodes of a function's
+// body).
+struct HeapStats {
+  std::size_t live_bytes;
+  std::size_t live_objects;
+  std::uint64_t allocations;
+  std::uint64_t frees;
+  // 0 when there is none
+  std::size_t limit;
+};
+
+// Thrown by an allocation that would take the live bytes past the limit
+struct HeapLimitError : std::bad_alloc {
+  const char *what() const noexcept override { return "Heap limit exceeded"; }
+};
+
+HeapStats heap_stats();
+
+// Applies to the whole process, every thread included. 0 lifts the limit.
+void set_heap_limit(std::size_t bytes);
+
+void *heap_allocate(std::size_t size);
+void heap_free(void *ptr, std::size_t size);
+
+// For values that come out of a pool of their own, to count them all the
+// same
+void heap_reserve(std::size_t size);
+void heap_release(std::size_t size);
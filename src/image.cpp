@@ -0,0 +1,776 @@
+#include "image.hpp"
+#include "bigint.hpp"
+#include "bytecode.hpp"
+#include "core.hpp"
+#include "expr.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "list.hpp"
+#include "memo.hpp"
+#include "node.hpp"
+#include "number.hpp"
+#include "source.hpp"
+#include "symbol.hpp"
+#include "variable.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr char Magic[8] = {'L', 'I', 'S', 'P', 'Y', 'I', 'M', 'G'};
+constexpr std::uint32_t Version = 3;
+
+// Native instructions refer to builtins by their index in the table, so an
+// image is tied to the table it was saved with
+std::uint64_t builtins_hash() {
+  std::uint64_t hash = 0xcbf29ce484222325;
+  for (std::size_t i = 0; i < builtin_count(); i++) {
+    for (char c : builtin(i).name) {
+      hash = (hash ^ (unsigned char)c) * 0x100000001b3;
+    }
+    hash = (hash ^ 0xff) * 0x100000001b3;
+  }
+  return hash;
+}
+
+class Writer {
+private:
+  std::string m_out;
+  // The sources of the functions written so far, each under its index in
+  // here plus one
+  std::vector<const SourceMap *> m_sources;
+  std::unordered_map<const SourceMap *, std::size_t> m_source_ids;
+
+public:
+  template <typename T> void put(T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    m_out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void size(std::size_t n) { put((std::uint32_t)n); }
+
+  void bytes(std::string_view data) {
+    size(data.size());
+    m_out.append(data);
+  }
+
+  void node(const Node &node) {
+    put((std::uint8_t)node.type);
+    switch (node.type) {
+    case Node::Undefined:
+      break;
+    case Node::Operator:
+      put(node.as<char>());
+      break;
+    case Node::Number:
+      number(node.value);
+      break;
+    case Node::Local:
+      put((std::int32_t)node.as<int>());
+      break;
+    case Node::Bool:
+      put((std::uint8_t)node.as<bool>());
+      break;
+    case Node::Keyword:
+      put((std::uint8_t)node.as<::Keyword>());
+      break;
+    case Node::Identifier:
+    case Node::Global:
+      put(node.as<SymbolId>());
+      break;
+    case Node::Vec:
+      vector(node.as<Vector>());
+      break;
+    case Node::List:
+      list(node.as<::List *>());
+      break;
+    case Node::Symbol:
+      variable(node.as<Variable>());
+      break;
+    case Node::Seq:
+      throw std::runtime_error("Cannot save a lazy sequence in an image");
+    }
+  }
+
+  void number(const Value &value) {
+    auto kind = Num::kind(value);
+    put((std::uint8_t)kind);
+    switch (kind) {
+    case Num::Small:
+      put((std::int32_t)value.as<int>());
+      break;
+    case Num::Wide:
+      put(value.as<Int64>().value);
+      break;
+    case Num::Big: {
+      const auto &big = value.as<BigInt>();
+      put((std::uint8_t)big.negative());
+      size(big.limbs().size());
+      for (auto limb : big.limbs()) {
+        put(limb);
+      }
+      break;
+    }
+    case Num::Float:
+      put(value.as<double>());
+      break;
+    }
+  }
+
+  void expr(const Expr &expr) {
+    node(expr.node);
+    put(expr.span.offset);
+    put(expr.span.length);
+    size(expr.items.size());
+    for (const auto &item : expr.items) {
+      this->expr(item);
+    }
+  }
+
+  // 0 when there is none
+  void source(const std::shared_ptr<const SourceMap> &map) {
+    if (map == nullptr) {
+      size(0);
+      return;
+    }
+    auto [it, added] =
+        m_source_ids.try_emplace(map.get(), m_sources.size() + 1);
+    if (added) {
+      m_sources.push_back(map.get());
+    }
+    size(it->second);
+  }
+
+  void sources(const std::vector<const SourceMap *> &maps) {
+    size(maps.size());
+    for (const auto *map : maps) {
+      bytes(map->name());
+      size(map->lines().size());
+      for (auto line : map->lines()) {
+        put(line);
+      }
+    }
+  }
+
+  void nodes(const std::vector<Node> &nodes) {
+    size(nodes.size());
+    for (const auto &n : nodes) {
+      node(n);
+    }
+  }
+
+  void vector(const Vector &vec) {
+    size(vec.size());
+    for (const auto &n : vec) {
+      node(n);
+    }
+  }
+
+  void list(const List *list) {
+    std::size_t n = 0;
+    for (auto *cell = list; cell != nullptr; cell = cell->next.get()) {
+      ++n;
+    }
+    size(n);
+    for (auto *cell = list; cell != nullptr; cell = cell->next.get()) {
+      number(cell->value);
+    }
+  }
+
+  void chunk(const Chunk &chunk) {
+    size(chunk.code.size());
+    for (std::size_t i = 0; i < chunk.code.size(); i++) {
+      put(chunk.code[i].op);
+      put(chunk.code[i].argc);
+      put(chunk.code[i].arg);
+      put(chunk.spans[i].offset);
+      put(chunk.spans[i].length);
+    }
+    nodes(chunk.constants);
+  }
+
+  void function(const Function &func) {
+    vector(func.params);
+    expr(func.body);
+    source(func.source);
+    put((std::uint8_t)(func.chunk != nullptr));
+    if (func.chunk) {
+      chunk(*func.chunk);
+    }
+    put((std::uint8_t)(func.memo != nullptr));
+    if (func.memo) {
+      put((std::uint64_t)func.memo->stats().capacity);
+    }
+  }
+
+  void variable(const Variable &var) {
+    put((std::uint8_t)var.type);
+    put(var.name);
+    switch (var.type) {
+    case Variable::Integer:
+      number(var.value);
+      break;
+    case Variable::Bool:
+      put((std::uint8_t)var.as<bool>());
+      break;
+    case Variable::Vec:
+      vector(var.as<Vector>());
+      break;
+    case Variable::List:
+      list(var.as<::List *>());
+      break;
+    case Variable::Function:
+      function(var.as<Function>());
+      break;
+    default:
+      throw std::runtime_error("Cannot save " + symbol_name(var.name) +
+                               " in an image");
+    }
+  }
+
+  void append(const Writer &other) { m_out += other.m_out; }
+
+  const std::vector<const SourceMap *> &sources() const { return m_sources; }
+  const std::string &data() const { return m_out; }
+};
+
+class Reader {
+private:
+  const char *m_pos;
+  const char *m_end;
+  // Symbol ids of the interpreter that saved the image, to ours
+  std::vector<SymbolId> m_ids;
+  // Parameter counts of the functions being read, innermost last, which
+  // the parameters their code refers to have to be within
+  std::vector<std::size_t> m_arities;
+  std::vector<std::shared_ptr<const SourceMap>> m_sources;
+
+public:
+  explicit Reader(std::string_view data)
+      : m_pos(data.data()), m_end(data.data() + data.size()) {}
+
+  [[noreturn]] static void corrupt() {
+    throw std::runtime_error("Corrupt image");
+  }
+
+  // A count of items that each take at least item_size bytes, checked
+  // against what is left before anything is allocated for them
+  std::size_t count(std::size_t item_size) {
+    auto n = size();
+    if ((std::size_t)(m_end - m_pos) / item_size < n) {
+      throw std::runtime_error("Image is truncated");
+    }
+    return n;
+  }
+
+  void check_local(std::uint32_t packed) {
+    auto depth = packed >> 16;
+    auto slot = packed & 0xffff;
+    if (depth >= m_arities.size() ||
+        slot >= m_arities[m_arities.size() - 1 - depth]) {
+      corrupt();
+    }
+  }
+
+  // An enumerator saved as a byte, which has to be one that exists
+  template <typename E> E enumerator(E last) {
+    auto raw = get<std::uint8_t>();
+    if (raw > last) {
+      corrupt();
+    }
+    return (E)raw;
+  }
+
+  static bool within_arity(const Builtin &builtin, std::size_t argc) {
+    return argc >= builtin.min_args && (builtin.max_args == Builtin::Variadic ||
+                                        argc <= builtin.max_args);
+  }
+
+  // Follows every path through the code the way the VM would run it, and
+  // checks that each operand refers to something that exists, that no
+  // instruction takes more values than are on the stack, that every path
+  // reaches the same depth wherever paths meet, and that each one ends in a
+  // Return with just the result on the stack
+  void verify(const Chunk &chunk) {
+    const auto &code = chunk.code;
+    std::vector<std::ptrdiff_t> depths(code.size(), -1);
+    std::vector<std::size_t> pending;
+    auto reach = [&](std::size_t at, std::ptrdiff_t depth) {
+      if (at >= code.size()) {
+        corrupt();
+      }
+      if (depths[at] < 0) {
+        depths[at] = depth;
+        pending.push_back(at);
+      } else if (depths[at] != depth) {
+        corrupt();
+      }
+    };
+
+    reach(0, 0);
+    while (!pending.empty()) {
+      auto at = pending.back();
+      pending.pop_back();
+      const auto &instr = code[at];
+      std::ptrdiff_t takes = 0;
+      std::ptrdiff_t pushes = 1;
+
+      switch (instr.op) {
+      case OpCode::Const:
+        if (instr.arg >= chunk.constants.size()) {
+          corrupt();
+        }
+        break;
+      case OpCode::Local:
+        check_local(instr.arg);
+        break;
+      case OpCode::Pop:
+        takes = 1;
+        pushes = 0;
+        break;
+      case OpCode::Op:
+        if (!within_arity(operator_builtin((char)instr.arg), instr.argc)) {
+          corrupt();
+        }
+        takes = instr.argc;
+        break;
+      case OpCode::Native:
+        if (instr.arg >= builtin_count() ||
+            !within_arity(builtin(instr.arg), instr.argc)) {
+          corrupt();
+        }
+        takes = instr.argc;
+        break;
+      case OpCode::Call:
+      case OpCode::TailCall:
+        takes = instr.argc;
+        break;
+      case OpCode::Apply: {
+        if (instr.arg >= chunk.constants.size()) {
+          corrupt();
+        }
+        // def is the only form that is left to collapse()
+        const auto &head = chunk.constants[instr.arg];
+        if (head.type == Node::Keyword && head.as<Keyword>() != Keyword::Def) {
+          corrupt();
+        }
+        takes = instr.argc;
+        break;
+      }
+      case OpCode::Defn:
+        if (instr.arg >= chunk.constants.size() ||
+            chunk.constants[instr.arg].type != Node::Symbol) {
+          corrupt();
+        }
+        break;
+      case OpCode::JumpIfFalse:
+      case OpCode::Jump:
+        takes = instr.op == OpCode::JumpIfFalse;
+        pushes = 0;
+        break;
+      case OpCode::Return:
+        if (depths[at] != 1) {
+          corrupt();
+        }
+        continue;
+      case OpCode::Profile:
+        pushes = 0;
+        break;
+      }
+
+      if (depths[at] < takes) {
+        corrupt();
+      }
+      auto depth = depths[at] - takes + pushes;
+      if (instr.op == OpCode::Jump || instr.op == OpCode::JumpIfFalse) {
+        reach(instr.arg, depth);
+      }
+      if (instr.op != OpCode::Jump) {
+        reach(at + 1, depth);
+      }
+    }
+  }
+
+  template <typename T> T get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if ((std::size_t)(m_end - m_pos) < sizeof(T)) {
+      throw std::runtime_error("Image is truncated");
+    }
+    T value;
+    std::memcpy(&value, m_pos, sizeof(T));
+    m_pos += sizeof(T);
+    return value;
+  }
+
+  std::size_t size() { return get<std::uint32_t>(); }
+
+  std::string_view bytes() {
+    auto n = size();
+    if ((std::size_t)(m_end - m_pos) < n) {
+      throw std::runtime_error("Image is truncated");
+    }
+    std::string_view data{m_pos, n};
+    m_pos += n;
+    return data;
+  }
+
+  void header() {
+    if ((std::size_t)(m_end - m_pos) < sizeof(Magic) ||
+        std::memcmp(m_pos, Magic, sizeof(Magic)) != 0) {
+      throw std::runtime_error("Not a lispy image");
+    }
+    m_pos += sizeof(Magic);
+    if (get<std::uint32_t>() != Version ||
+        get<std::uint64_t>() != builtins_hash()) {
+      throw std::runtime_error(
+          "Image was saved by a different build of lispy");
+    }
+  }
+
+  void symbols() {
+    m_ids.resize(count(sizeof(std::uint32_t)));
+    for (auto &id : m_ids) {
+      id = intern(bytes());
+    }
+  }
+
+  SymbolId symbol() {
+    auto id = get<SymbolId>();
+    if (id >= m_ids.size()) {
+      throw std::runtime_error("Image refers to an unknown symbol");
+    }
+    return m_ids[id];
+  }
+
+  Node node() {
+    auto type = enumerator(Node::Seq);
+    switch (type) {
+    case Node::Undefined:
+      return {};
+    case Node::Operator:
+      return {type, get<char>()};
+    case Node::Number:
+      return {type, number()};
+    case Node::Local: {
+      auto packed = get<std::int32_t>();
+      check_local(packed);
+      return {type, (int)packed};
+    }
+    case Node::Bool:
+      return {type, (bool)get<std::uint8_t>()};
+    case Node::Keyword:
+      return {type, enumerator(::Keyword::Profile)};
+    case Node::Identifier:
+    case Node::Global:
+      return {type, symbol()};
+    case Node::Vec:
+      return {type, vector()};
+    case Node::List:
+      return {type, list().get()};
+    case Node::Symbol:
+      return {type, variable()};
+    default:
+      throw std::runtime_error("Image holds an unknown kind of value");
+    }
+  }
+
+  // Goes back through the narrowest representation, so a number stays
+  // canonical even if the image was not
+  Value number() {
+    switch (get<std::uint8_t>()) {
+    case Num::Small:
+      return (int)get<std::int32_t>();
+    case Num::Wide:
+      return Num::from(get<std::int64_t>());
+    case Num::Big: {
+      bool negative = get<std::uint8_t>();
+      std::vector<std::uint32_t> limbs(count(sizeof(std::uint32_t)));
+      for (auto &limb : limbs) {
+        limb = get<std::uint32_t>();
+      }
+      return Num::from(BigInt::from_limbs(negative, std::move(limbs)));
+    }
+    case Num::Float:
+      return Num::from(get<double>());
+    default:
+      throw std::runtime_error("Image holds an unknown kind of number");
+    }
+  }
+
+  std::vector<Node> nodes() {
+    // Every node takes at least the byte of its type
+    std::vector<Node> out(count(1));
+    for (auto &n : out) {
+      n = node();
+    }
+    return out;
+  }
+
+  // The walker and the compilers take it for granted that a tree has a
+  // shape compile() could have built: forms are not empty and do not start
+  // with a form, a keyword only ever starts one, and the forms that start with
+  // one have the items it needs
+  Expr expr() {
+    Expr out;
+    out.node = node();
+    out.span.offset = get<std::uint32_t>();
+    out.span.length = get<std::uint32_t>();
+    // Every item takes at least its type, span and count of items
+    auto n = count(1 + 3 * sizeof(std::uint32_t));
+    if (n > 0 && out.node.type != Node::Undefined) {
+      corrupt();
+    }
+    out.items.reserve(n);
+    for (std::size_t i = 0; i < n; i++) {
+      // The body of a defn sees its parameters
+      bool body = i == 3 && (out.is_keyword(Keyword::Defn) ||
+                             out.is_keyword(Keyword::DefnMemo));
+      if (body) {
+        if (out.items[2].is_form() || out.items[2].node.type != Node::Vec) {
+          corrupt();
+        }
+        m_arities.push_back(out.items[2].node.as<Vector>().size());
+      }
+      out.items.push_back(expr());
+      if (body) {
+        m_arities.pop_back();
+      }
+      const auto &item = out.items.back();
+      if ((i == 0 && item.is_form()) ||
+          (i > 0 && item.node.type == Node::Keyword)) {
+        corrupt();
+      }
+    }
+
+    if (!out.is_form()) {
+      if (out.node.type == Node::Undefined || out.node.type == Node::Symbol) {
+        corrupt();
+      }
+      return out;
+    }
+    if (out.head().node.type == Node::Keyword) {
+      form(out);
+    }
+    return out;
+  }
+
+  void form(const Expr &expr) {
+    auto atom = [&](std::size_t i, Node::Type type) {
+      return !expr.items[i].is_form() && expr.items[i].node.type == type;
+    };
+    switch (expr.head().node.as<Keyword>()) {
+    case Keyword::If:
+      if (expr.items.size() != 4) {
+        corrupt();
+      }
+      break;
+    case Keyword::Defn:
+    case Keyword::DefnMemo:
+      if (expr.items.size() != 4 || !atom(1, Node::Identifier) ||
+          !atom(2, Node::Vec)) {
+        corrupt();
+      }
+      break;
+    case Keyword::Profile:
+      if (expr.items.size() != 2) {
+        corrupt();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  // The sources functions refer to. Positions are looked up in their line
+  // tables by binary search, so each one has to start at 0 and go up.
+  void sources() {
+    m_sources.resize(count(2 * sizeof(std::uint32_t)));
+    for (auto &map : m_sources) {
+      std::string name(bytes());
+      std::vector<std::uint32_t> lines(count(sizeof(std::uint32_t)));
+      for (auto &line : lines) {
+        line = get<std::uint32_t>();
+      }
+      if (lines.empty() || lines[0] != 0 ||
+          std::adjacent_find(lines.begin(), lines.end(),
+                             std::greater_equal<>()) != lines.end()) {
+        corrupt();
+      }
+      map = std::make_shared<const SourceMap>(std::move(name),
+                                              std::move(lines));
+    }
+  }
+
+  std::shared_ptr<const SourceMap> source() {
+    auto index = size();
+    if (index > m_sources.size()) {
+      corrupt();
+    }
+    return index == 0 ? nullptr : m_sources[index - 1];
+  }
+
+  Vector vector() {
+    Vector vec;
+    for (auto n = count(1); n > 0; n--) {
+      vec.push_back(node());
+    }
+    return vec;
+  }
+
+  // Built front to back so the cells end up in order in the pool
+  Ref<List> list() {
+    Ref<List> list;
+    List *curr = nullptr;
+    for (auto n = count(1); n > 0; n--) {
+      auto *cell = new List(number());
+      if (curr == nullptr) {
+        list = Ref<List>(cell);
+      } else {
+        curr->next = Ref<List>(cell);
+      }
+      curr = cell;
+    }
+    return list;
+  }
+
+  std::shared_ptr<const Chunk> chunk(std::shared_ptr<const SourceMap> source) {
+    auto chunk = std::make_shared<Chunk>();
+    chunk->source = std::move(source);
+    chunk->code.resize(count(sizeof(OpCode) + sizeof(std::uint16_t) +
+                             3 * sizeof(std::uint32_t)));
+    chunk->spans.resize(chunk->code.size());
+    for (std::size_t i = 0; i < chunk->code.size(); i++) {
+      auto &instr = chunk->code[i];
+      instr.op = get<OpCode>();
+      instr.argc = get<std::uint16_t>();
+      instr.arg = get<std::uint32_t>();
+      chunk->spans[i].offset = get<std::uint32_t>();
+      chunk->spans[i].length = get<std::uint32_t>();
+      if (instr.op > OpCode::Profile) {
+        throw std::runtime_error("Image holds an unknown instruction");
+      }
+      if (instr.op == OpCode::Call || instr.op == OpCode::TailCall) {
+        if (instr.arg >= m_ids.size()) {
+          throw std::runtime_error("Image refers to an unknown symbol");
+        }
+        instr.arg = m_ids[instr.arg];
+      }
+    }
+    chunk->constants = nodes();
+    verify(*chunk);
+    return chunk;
+  }
+
+  Function function() {
+    Function func;
+    func.params = vector();
+    m_arities.push_back(func.params.size());
+    func.body = expr();
+    if (func.body.node.type == Node::Keyword) {
+      corrupt();
+    }
+    func.source = source();
+    if (get<std::uint8_t>()) {
+      func.chunk = chunk(func.source);
+    }
+    m_arities.pop_back();
+    if (get<std::uint8_t>()) {
+      func.memo = std::make_shared<Memo>(get<std::uint64_t>());
+    }
+    func.jit = std::make_shared<Jit>();
+    return func;
+  }
+
+  Variable variable() {
+    auto type = enumerator(Variable::NativeFn);
+    auto name = symbol();
+    switch (type) {
+    case Variable::Integer:
+      return {type, name, number()};
+    case Variable::Bool:
+      return {type, name, (bool)get<std::uint8_t>()};
+    case Variable::Vec:
+      return {type, name, vector()};
+    case Variable::List:
+      return {type, name, list().get()};
+    case Variable::Function:
+      return {type, name, function()};
+    default:
+      throw std::runtime_error("Image holds an unknown kind of global");
+    }
+  }
+
+  bool done() const { return m_pos == m_end; }
+};
+
+} // namespace
+
+void save_image(const Interpreter &ctx, const std::string &path) {
+  Writer out;
+  for (char c : Magic) {
+    out.put(c);
+  }
+  out.put(Version);
+  out.put(builtins_hash());
+
+  out.size(symbol_count());
+  for (std::size_t id = 0; id < symbol_count(); id++) {
+    out.bytes(symbol_name(id));
+  }
+
+  std::vector<const Variable *> globals;
+  for (std::size_t id = 0; id < symbol_count(); id++) {
+    const auto *var = ctx.get_symbol(id);
+    if (var != nullptr && var->type != Variable::NativeFn) {
+      globals.push_back(var);
+    }
+  }
+  // Written apart first, to find the sources that go ahead of them
+  Writer vars;
+  vars.size(globals.size());
+  for (const auto *var : globals) {
+    vars.variable(*var);
+  }
+  out.sources(vars.sources());
+  out.append(vars);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(out.data().data(), out.data().size());
+  if (!file) {
+    throw std::runtime_error("Could not write " + path);
+  }
+}
+
+void load_image(Interpreter &ctx, const std::string &path) {
+  SourceFile file(path);
+  Reader in(file.view());
+  in.header();
+  in.symbols();
+  in.sources();
+
+  // Decoded in full before any of it is defined, so that a bad image leaves
+  // ctx as it was
+  std::vector<Variable> globals;
+  for (auto n = in.count(1); n > 0; n--) {
+    globals.push_back(in.variable());
+  }
+  if (!in.done()) {
+    throw std::runtime_error("Image has trailing data");
+  }
+
+  for (auto &var : globals) {
+    ctx.add_symbol(var.name, std::move(var));
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+class Interpreter;
+
+// An image is a snapshot of the globals a program defined: numbers, bools,
+// vectors, lists and functions, with both the expression trees the walker runs
+// and the chunks the VM runs, plus the line tables of the sources they came
+// from, so that their errors are still reported where they are. It holds no
+// pointers, only symbol ids, which are mapped through the symbol names saved
+// alongside them when it is loaded, so loading one skips parsing, resolving,
+// folding and compiling altogether.
+//
+// Builtins are left out, since every interpreter registers them itself, and so
+// are the results memoized functions have cached. An image can only be loaded
+// by a build with the same builtins as the one that saved it.
+
+void save_image(const Interpreter &ctx, const std::string &path);
+// Defines every global in the image in ctx, which is mapped rather than read
+void load_image(Interpreter &ctx, const std::string &path);
@@ -1,259 +1,222 @@
 #include "interpreter.hpp"
 #include "core.hpp"
+#include "expr.hpp"
+#include "jit.hpp"
 #include "list.hpp"
+#include "memo.hpp"
 #include "node.hpp"
+#include "number.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+#include "seq.hpp"
 #include "variable.hpp"
 
-#include <algorithm>
 #include <cstddef>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <vector>
 
-void print_nodes(std::vector<Node> nodes) {
-  for (auto &n : nodes) {
-    n.print_debug(0);
+void print_nodes(const std::vector<Expr> &exprs) {
+  for (auto &e : exprs) {
+    e.print_debug(0);
   }
 }
 
-std::vector<Node> Interpreter::compile(std::vector<Token> tokens,
-                                       std::size_t depth, std::size_t *parsed) {
-  std::vector<Node> nodes;
-  std::size_t next_expr_is_body = 0;
-  std::size_t paren_count = 1;
-
-  for (std::size_t i = 0; i < tokens.size(); i++) {
-    auto &t = tokens[i];
-
-    switch (t.type) {
-    case Token::Paren: {
-      char c = t.as<char>();
-
-      if (next_expr_is_body == 0 && depth > 0 && c == '(') {
-        paren_count++;
-        nodes.push_back({Node::Paren, c});
-        break;
-      }
-
-      if (next_expr_is_body > 0 && c == '(') {
-        std::size_t len;
-        auto body =
-            compile({tokens.begin() + i, tokens.end()}, depth + 1, &len);
-        nodes.push_back({Node::Body, body});
-        i += len;
-        --next_expr_is_body;
-        break;
-      }
-
-      nodes.push_back({Node::Paren, c});
-
-      if (depth > 0 && c == ')') {
-        paren_count--;
-        if (paren_count == 1) {
-          *parsed = i;
-          return nodes;
-        }
-      }
-
-      break;
-    }
-    case Token::Bracket: {
-      if (t.as<char>() == ']') {
-        std::cerr << "No matching bracket" << std::endl;
-        return {};
-      }
-      Vector vec;
-      t = tokens[++i];
-      while (t.type != Token::Bracket) {
-        vec.add_element(t);
-        t = tokens[++i];
-      }
-      nodes.push_back({Node::Vec, vec});
-      break;
-    }
-    case Token::Quote:
-      if (t.as<char>() == '\'') {
-        auto next = tokens[i + 1];
-        if (next.type == Token::Paren && next.as<char>() == '(') {
-          ++i;
-          next = tokens[++i];
-
-          List *list = new List();
-          List *curr = list;
-
-          while (true) {
-            next = next.get_if(Token::Number);
-            curr->value = next.as<int>();
-            curr->next = new List();
-            next = tokens[++i];
-            if (next.type != Token::Paren) {
-              curr = curr->next;
-            } else {
-              break;
-            }
-          }
-
-          delete curr->next;
-          curr->next = nullptr;
-          nodes.push_back({Node::List, list});
-        }
-      }
-      break;
-    case Token::Operator:
-      nodes.push_back({Node::Operator, t.as<char>()});
-      break;
-    case Token::Number:
-      nodes.push_back({Node::Number, t.as<int>()});
-      break;
-    case Token::Bool:
-      nodes.push_back({Node::Bool, t.as<bool>()});
-      break;
-    case Token::Keyword: {
-      auto type = t.as<Keyword>();
-      nodes.push_back({Node::Keyword, type});
-      switch (type) {
-      case Keyword::Defn:
-        next_expr_is_body = 1;
-        break;
-      case Keyword::If:
-        next_expr_is_body = 3;
-      default:
-        break;
-      }
-      break;
-    }
-    case Token::Identifier:
-      nodes.push_back({Node::Identifier, t.as<std::string>()});
-      break;
-    }
+namespace {
+
+// Calls of walk() the C++ stack is trusted to hold, one for each form being
+// evaluated. With the collapse() between them a call of a user function takes
+// a few, at around half a kilobyte each, which keeps this well within the 8 MB
+// that threads get by default.
+constexpr std::size_t MaxWalkDepth = 8192;
+
+// (defn name [params] body), which the compiler made sure has that shape
+Node define(Interpreter &ctx, const Expr &expr,
+            const std::shared_ptr<const SourceMap> &source) {
+  auto args = expr.args();
+  auto name = args[0].node.as<SymbolId>();
+  std::shared_ptr<Memo> memo;
+  if (expr.is_keyword(Keyword::DefnMemo)) {
+    memo = std::make_shared<Memo>();
   }
-
-  if (depth == 0) {
-    // print_nodes(nodes);
-  }
-
-  return nodes;
+  auto v = Variable{Variable::Function, name,
+                    Function{args[1].node.as<Vector>(), args[2], source,
+                             nullptr, std::move(memo),
+                             std::make_shared<Jit>()}};
+  ctx.add_symbol(name, v);
+  return {Node::Symbol, v};
 }
 
-Node collapse(Interpreter &ctx, Node action, std::vector<Node> args) {
+} // namespace
+
+Node collapse(Interpreter &ctx, const Node &action, std::span<Node> args,
+              bool tail) {
   switch (action.type) {
-  case Node::Operator:
-    switch (action.as<char>()) {
-    case '+':
-      return Core::add(ctx, args);
-      break;
-    case '*':
-      return Core::multiply(ctx, args);
-    case '-':
-      return Core::minus(ctx, args);
-    case '/':
-      return Core::divide(ctx, args);
-    case '=':
-      return Core::equals(ctx, args);
-    case '<':
-      return Core::less_than(ctx, args);
-    case '>':
-      return Core::greater_than(ctx, args);
-    default:
-      break;
-    }
-    break;
+  case Node::Operator: {
+    const auto &op = operator_builtin(action.as<char>());
+    op.check_arity(args.size());
+    return op.call(ctx, args);
+  }
   case Node::Keyword:
     switch (action.as<Keyword>()) {
     case Keyword::Def: {
+      if (args.size() != 2) {
+        throw std::runtime_error("def requires a name and a value");
+      }
+      auto name = args[0].get_if(Node::Identifier).as<SymbolId>();
+
+      // A parameter or global is bound to the value it holds
+      auto value = args[1];
+      if (value.type == Node::Local || value.type == Node::Global) {
+        for (auto type : {Node::Number, Node::Vec, Node::List, Node::Bool}) {
+          auto node = Core::eval_id(ctx, value, type);
+          if (node.type != Node::Undefined) {
+            value = std::move(node);
+            break;
+          }
+        }
+      }
+
       Variable v;
-      auto name = args[1].get_if(Node::Identifier).as<std::string>();
-      switch (args[0].type) {
+      switch (value.type) {
       case Node::Number:
-        v = Variable{Variable::Integer, name, args[0].as<int>()};
+        v = Variable{Variable::Integer, name, value.value};
         break;
       case Node::Vec:
-        v = Variable{Variable::Vec, name, args[0].as<Vector>()};
+        v = Variable{Variable::Vec, name, value.value};
+        break;
+      case Node::Seq:
+        v = Variable{Variable::Vec, name, value.as<Seq>().realize(ctx)};
         break;
       case Node::List:
-        v = Variable{Variable::List, name, args[0].as<List *>()};
+        v = Variable{Variable::List, name, value.value};
         break;
       case Node::Bool:
-        v = Variable{Variable::Bool, name, args[0].as<bool>()};
+        v = Variable{Variable::Bool, name, value.value};
         break;
       default:
-        break;
+        throw std::runtime_error("def requires a number, vector, list or bool");
       }
       ctx.add_symbol(name, v);
       return {Node::Symbol, v};
     }
-    case Keyword::Defn: {
-      auto body = args[0].get_if(Node::Body).as<std::vector<Node>>();
-      auto params = args[1].get_if(Node::Vec).as<Vector>();
-      auto name = args[2].get_if(Node::Identifier).as<std::string>();
-      auto func = Function{params, body};
-      auto v = Variable{Variable::Function, name, func};
-      ctx.add_symbol(name, v);
-      return {Node::Symbol, v};
-    }
-    case Keyword::If: {
-      auto eval = args[2].get_if(Node::Body).as<std::vector<Node>>();
-      auto truthy = args[1].get_if(Node::Body).as<std::vector<Node>>();
-      auto falsey = args[0].get_if(Node::Body).as<std::vector<Node>>();
-
-      ctx.new_scope();
-      Node ret = ctx.run(eval).get_if(Node::Bool);
-      ctx.drop_scope();
-
-      bool result = ret.as<bool>();
-      Node final_result;
-      ctx.new_scope();
-      if (result) {
-        final_result = ctx.run(truthy);
-      } else {
-        final_result = ctx.run(falsey);
-      }
-      ctx.drop_scope();
-
-      return final_result;
-    }
     default:
       break;
     }
     break;
-  case Node::Identifier: {
-    auto sym = ctx.get_symbol(action.as<std::string>());
-    if (!sym.has_value()) {
+  case Node::Local:
+    return ctx.get_local(action);
+  case Node::Global: {
+    const auto *found = ctx.get_symbol(action.as<SymbolId>());
+    if (found == nullptr) {
       throw std::runtime_error("No such symbol exists");
     }
 
-    if (!sym->is_function()) {
-      return {Node::Number, sym->as<int>()};
+    // Copied because running the body may rebind symbols under our feet
+    auto sym = *found;
+
+    if (!sym.is_function()) {
+      // Of the other globals, only numbers can be read by naming them
+      if (sym.type != Variable::Integer) {
+        throw std::runtime_error("Value::as() type mismatch");
+      }
+      return {Node::Number, std::move(sym.value)};
     }
 
     // LISP function
-    if (sym->type == Variable::Function) {
-      auto func = sym->as<Function>();
-
-      ctx.new_scope();
-      std::reverse(args.begin(), args.end());
-      for (std::size_t i = 0; i < func.params.data.size(); i++) {
-        auto p_name = func.params.data[i].as<std::string>();
-        auto value =
-            args[i].get_if_or(Node::Number, ctx, Core::eval_id).as<int>();
-        ctx.add_symbol(p_name, {Variable::Integer, p_name, value});
+    if (sym.type == Variable::Function) {
+      // Arguments are evaluated in the caller's frame before ours is entered
+      auto nparams = sym.as<Function>().params.size();
+      if (args.size() < nparams) {
+        throw std::runtime_error("Too few arguments");
+      }
+      args = args.first(nparams);
+      for (auto &arg : args) {
+        if (arg.type != Node::Number) {
+          arg = arg.get_if_or(Node::Number, ctx, Core::eval_id);
+        }
+      }
+
+      if (auto native = ctx.jit_call(sym, args)) {
+        return std::move(*native);
+      }
+
+      // Copied because a tail call in the body replaces sym
+      auto memo = sym.as<Function>().memo;
+
+      // A call in tail position hands its arguments back to the loop below
+      // in whichever call is already running, so the stack stays flat. A
+      // memoized call needs its own result, so it always runs here.
+      if (tail && !memo) {
+        ctx.defer_call(std::move(sym), args);
+        return {};
+      }
+
+      auto *profiler = ctx.profiler();
+      ProfileScope profile(profiler);
+      if (profiler != nullptr) {
+        profiler->enter(sym.name);
+      }
+
+      std::optional<Memo::Key> key;
+      if (memo) {
+        key = Memo::key(args);
+        if (auto hit = memo->find(*key)) {
+          return std::move(*hit);
+        }
+      }
+
+      auto base = ctx.locals_size();
+      ctx.enter_frame(base);
+      for (auto &arg : args) {
+        ctx.push_local(std::move(arg));
+      }
+      Node ret;
+      std::vector<Node> next;
+      while (true) {
+        const auto &func = sym.as<Function>();
+        ret = func.chunk ? ctx.execute(*func.chunk)
+                         : ctx.walk(func.body, func.source, true);
+        if (!ctx.take_deferred_call(sym, next)) {
+          break;
+        }
+        if (auto native = ctx.jit_call(sym, next)) {
+          ret = std::move(*native);
+          break;
+        }
+        if (profiler != nullptr) {
+          profiler->leave();
+          profiler->enter(sym.name);
+        }
+        ctx.truncate_locals(base);
+        for (auto &arg : next) {
+          ctx.push_local(std::move(arg));
+        }
+      }
+      ctx.leave_frame();
+
+      if (memo) {
+        memo->insert(std::move(*key), ret);
       }
-      Node ret = ctx.run(func.body);
-      ctx.drop_scope();
 
       return ret;
     }
 
     // Native function
-    else if (sym->type == Variable::NativeFn) {
-      auto func = sym->as<NativeFunction>();
-      ctx.new_scope();
-      std::reverse(args.begin(), args.end());
-      auto ret = func(ctx, args);
-      ctx.drop_scope();
-      return ret;
+    else if (sym.type == Variable::NativeFn) {
+      auto *profiler = ctx.profiler();
+      ProfileScope profile(profiler);
+      if (profiler != nullptr) {
+        profiler->enter(sym.name);
+      }
+
+      const auto &native = builtin(sym.as<int>());
+      native.check_arity(args.size());
+      return native.call(ctx, args);
     }
+    break;
   }
   case Node::Bool:
   case Node::Number:
@@ -265,59 +228,192 @@ Node collapse(Interpreter &ctx, Node action, std::vector<Node> args) {
   return {};
 }
 
-void eval(Interpreter &ctx, Stack<Node> &stack) {
-  std::vector<Node> args;
-
-  while (!stack.is_empty()) {
-    auto node = stack.pop();
-    if (stack.peek().type == Node::Paren && stack.peek().as<char>() == '(') {
-      stack.pop();
-      stack.push(collapse(ctx, node, args));
-      return;
+Node Interpreter::run(const Program &program) {
+  if (!m_bytecode) {
+    Node ret;
+    for (const auto &expr : program.exprs) {
+      ret = walk(expr, program.source);
     }
-    args.push_back(node);
+    return ret;
+  }
+
+  // Once a global has been defined, the caches of every chunk are stale,
+  // including those of the functions it replaced
+  if (m_caches_epoch != m_epoch) {
+    m_caches.clear();
+    m_caches_epoch = m_epoch;
   }
+
+  // The program's own chunk does not outlive it, and neither do its caches
+  struct CachesGuard {
+    decltype(m_caches) &caches;
+    const Chunk *chunk;
+    ~CachesGuard() { caches.erase(chunk); }
+  };
+  auto chunk = compile_chunk(program);
+  CachesGuard guard{m_caches, chunk.get()};
+  return execute(*chunk);
 }
 
-Node Interpreter::run(std::vector<Node> program) {
-  Stack<Node> stack;
-
-  for (auto &p : program) {
-    switch (p.type) {
-    case Node::Paren: {
-      char c = p.as<char>();
-      if (c == ')') {
-        eval(*this, stack);
-      } else {
-        stack.push(p);
+// An expression is in tail position when its value is the value of the
+// function it is in, so a call there can hand its arguments back to the call
+// that is already running instead of nesting
+Node Interpreter::walk(const Expr &expr,
+                       const std::shared_ptr<const SourceMap> &source,
+                       bool tail) {
+  struct DepthGuard {
+    std::size_t &depth;
+    ~DepthGuard() { --depth; }
+  };
+
+  try {
+    if (m_walk_depth == MaxWalkDepth) {
+      throw std::runtime_error("Stack overflow");
+    }
+    DepthGuard guard{++m_walk_depth};
+
+    if (!expr.is_form()) {
+      return expr.node.type == Node::Local ? get_local(expr.node) : expr.node;
+    }
+
+    const auto &head = expr.head();
+    if (head.node.type == Node::Keyword) {
+      switch (head.node.as<Keyword>()) {
+      case Keyword::If: {
+        auto cond = walk(expr.items[1], source).get_if(Node::Bool);
+        return walk(expr.items[cond.as<bool>() ? 2 : 3], source, tail);
+      }
+      case Keyword::Defn:
+      case Keyword::DefnMemo:
+        return define(*this, expr, source);
+      case Keyword::Profile: {
+        begin_profile();
+        auto ret = walk(expr.items[1], source);
+        end_profile();
+        return ret;
+      }
+      default:
+        // def is applied like any other form
+        break;
       }
-      break;
     }
-    default:
-      stack.push(p);
-      break;
+
+    // Globals and the names def binds are passed as they are, to be
+    // resolved by whatever they are passed to
+    auto args = expr.args();
+    for (const auto &arg : args) {
+      m_operands.push(walk(arg, source));
     }
+    CallArgs values(m_operands.top(args.size()));
+    m_operands.drop(args.size());
+    return collapse(*this, head.node, values.get(), tail);
+  } catch (...) {
+    rethrow_at(expr.span, source);
+  }
+}
+
+const Variable *Interpreter::get_symbol(SymbolId id) const {
+  const auto &globals = *m_globals;
+  if (id >= globals.size() || !globals[id].has_value()) {
+    return nullptr;
   }
+  return &*globals[id];
+}
 
-  return stack.pop();
+void Interpreter::add_symbol(SymbolId id, Variable v) {
+  const auto *found = get_symbol(id);
+  if (found != nullptr && found->type == Variable::NativeFn) {
+    throw std::runtime_error("Cannot redefine builtin " + symbol_name(id));
+  }
+  // Whoever else holds the globals is another interpreter, which must not see
+  // what this one defines. Only we can add to a count of one, so reading it
+  // is safe while forks of us run on other threads.
+  if (m_globals.use_count() > 1) {
+    m_globals = std::make_shared<Globals>(*m_globals);
+  }
+  auto &globals = *m_globals;
+  if (id >= globals.size()) {
+    globals.resize(symbol_count());
+  }
+  globals[id] = std::move(v);
+  ++m_epoch;
 }
 
-std::optional<Variable> Interpreter::get_symbol(const std::string &name) const {
-  auto scope = m_symbols;
-  while (!scope.is_empty()) {
-    auto vars = scope.pop();
-    auto it = vars.find(name);
-    if (it != vars.end()) {
-      return it->second;
-    }
+CallCache *Interpreter::call_caches(const Chunk &chunk) {
+  // A chunk can take the place of one that was freed, whose caches are all
+  // from an older epoch
+  auto &caches = m_caches[&chunk];
+  if (caches.size() != chunk.code.size()) {
+    caches.assign(chunk.code.size(), {});
+  }
+  return caches.data();
+}
+
+const Node &Interpreter::get_local(std::size_t depth, std::size_t slot) const {
+  if (depth >= m_frames.size()) {
+    throw std::runtime_error("Parameter referenced outside of its function");
+  }
+  return m_locals[m_frames[m_frames.size() - 1 - depth] + slot];
+}
+
+void Interpreter::reset() {
+  m_locals.clear();
+  m_frames.clear();
+  m_stack.clear();
+  m_operands.drop(m_operands.size());
+  m_deferred.reset();
+  m_profiles.clear();
+  m_walk_depth = 0;
+}
+
+Interpreter Interpreter::fork() const {
+  Interpreter worker = *this;
+  worker.reset();
+  worker.m_profiler = nullptr;
+  // Ours are written as we run, and the worker's thread must not share them
+  worker.m_caches.clear();
+  return worker;
+}
+
+std::optional<Node> Interpreter::jit_call(const Variable &fn,
+                                          std::span<const Node> args) {
+  const auto &func = fn.as<Function>();
+  // Profiles and memoized functions need every call to go through the
+  // interpreter
+  if (!m_jit || func.jit == nullptr || func.memo != nullptr ||
+      profiler() != nullptr) {
+    return std::nullopt;
   }
-  return std::optional<Variable>();
+  return func.jit->call(*this, func, fn.name, args);
+}
+
+void Interpreter::defer_call(Variable fn, std::span<Node> args) {
+  m_deferred = std::move(fn);
+  m_deferred_args.assign(std::make_move_iterator(args.begin()),
+                         std::make_move_iterator(args.end()));
 }
 
-void Interpreter::add_symbol(const std::string &name, Variable v) {
-  m_symbols.peek().insert(std::make_pair(name, v));
+bool Interpreter::take_deferred_call(Variable &fn, std::vector<Node> &args) {
+  if (!m_deferred.has_value()) {
+    return false;
+  }
+  fn = std::move(*m_deferred);
+  args.swap(m_deferred_args);
+  m_deferred.reset();
+  return true;
 }
 
-void Interpreter::new_scope() { m_symbols.push({}); }
+void Interpreter::begin_profile() { m_profiles.emplace_back(profiler()); }
 
-void Interpreter::drop_scope() { m_symbols.pop(); }
+void Interpreter::end_profile() {
+  if (m_profiles.empty()) {
+    return;
+  }
+  m_profiles.back().print(std::cerr);
+  m_profiles.pop_back();
+}
+
+void Interpreter::leave_frame() {
+  m_locals.resize(m_frames.back());
+  m_frames.pop_back();
+}
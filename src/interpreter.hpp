@@ -1,52 +1,164 @@
 #pragma once
 
+#include "bytecode.hpp"
 #include "core.hpp"
+#include "expr.hpp"
 #include "node.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
 #include "stack.hpp"
+#include "symbol.hpp"
 #include "variable.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
 #include <optional>
-#include <string>
+#include <span>
 #include <unordered_map>
-
-#define NFN(x)                                                                 \
-  add_symbol(#x, Variable{Variable::NativeFn, #x, (NativeFunction)Core::x})
+#include <utility>
+#include <vector>
 
 class Interpreter {
 private:
-  Stack<std::unordered_map<std::string, Variable>> m_symbols;
+  // Globals are indexed directly by symbol id. Forks share them with the
+  // interpreter they were forked from until either defines one, which first
+  // gives it a copy of its own.
+  using Globals = std::vector<std::optional<Variable>>;
+  std::shared_ptr<Globals> m_globals = std::make_shared<Globals>();
+
+  // The VM's inline caches, one per instruction of each chunk it has run
+  // here. They point into m_globals, so every interpreter (and every fork of
+  // one, which a worker thread runs on) fills in its own. Bumping m_epoch
+  // whenever a global is defined invalidates all of them at once.
+  std::unordered_map<const Chunk *, std::vector<CallCache>> m_caches;
+  std::uint64_t m_epoch = 1;
+  std::uint64_t m_caches_epoch = 1;
+
+  // Parameters of every active call live in one flat array; each call frame
+  // is just the offset of its first slot
+  std::vector<Node> m_locals;
+  std::vector<std::size_t> m_frames;
+
+  // A user function call the walker made in tail position, waiting to be
+  // picked up by the call that is already on the C++ stack. The arguments
+  // are swapped with the caller's, so a loop of tail calls reuses two buffers.
+  std::optional<Variable> m_deferred;
+  std::vector<Node> m_deferred_args;
+
+  // Operand stacks of the bytecode VM and of the walker. Nested calls push
+  // above the frames of the calls they were made from.
+  std::vector<Node> m_stack;
+  Stack<Node> m_operands;
+  // How many calls of walk() are on the C++ stack. The VM keeps its frames
+  // on the heap, but the walker recurses for every form and every call, so
+  // it has to stop before it runs out of stack.
+  std::size_t m_walk_depth = 0;
+  bool m_bytecode = true;
+  bool m_jit = true;
+
+  // Profiles the whole run when set (see --profile). Each open (profile expr)
+  // form stacks a profiler of its own on top, which passes its calls on to
+  // the one below.
+  Profiler *m_profiler = nullptr;
+  std::deque<Profiler> m_profiles;
 
 public:
   Interpreter() {
-    std::cout << "Loading interpreter..." << std::endl;
-    new_scope();
-
-    // TODO: there might be an easier way to handle this
-    NFN(sqrt);
-    NFN(map);
-    NFN(range);
-    NFN(size);
-    NFN(len);
-    NFN(head);
-    NFN(tail);
-    NFN(nth);
-    NFN(rem);
-    NFN(filter);
-    NFN(reduce);
+    for (std::size_t i = 0; i < builtin_count(); i++) {
+      auto name = intern(builtin(i).name);
+      add_symbol(name, Variable{Variable::NativeFn, name, (int)i});
+    }
   }
   ~Interpreter() {}
 
-  std::vector<Node> compile(std::vector<Token> tokens, std::size_t depth = 0,
-                            std::size_t *parsed = nullptr);
+  // Builds the resolved, folded expression tree of a program in one pass
+  // over its tokens (see compiler.cpp), whose spans point into source.
+  // Malformed programs throw a SyntaxError.
+  Program compile(std::span<const Token> tokens,
+                  std::shared_ptr<const SourceMap> source = nullptr);
+
+  // Runs a compiled program on the bytecode VM, or on the tree walker when
+  // bytecode is turned off. Errors are raised as an EvalError at the
+  // innermost expression that was being evaluated.
+  Node run(const Program &program);
+  Node walk(const Expr &expr, const std::shared_ptr<const SourceMap> &source,
+            bool tail = false);
+  Node execute(const Chunk &chunk);
+
+  void set_bytecode(bool enabled) { m_bytecode = enabled; }
+  void set_jit(bool enabled) { m_jit = enabled; }
+
+  // Runs fn on args as native code, if it is hot enough to have some and
+  // nothing rules it out (see jit.hpp). Otherwise the caller has to make the
+  // call itself.
+  std::optional<Node> jit_call(const Variable &fn, std::span<const Node> args);
+
+  // The profiler calls should be reported to, if any
+  Profiler *profiler() {
+    return m_profiles.empty() ? m_profiler : &m_profiles.back();
+  }
+  void set_profiler(Profiler *profiler) { m_profiler = profiler; }
+  void begin_profile();
+  // Prints what the calls made since the matching begin_profile() took
+  void end_profile();
+
+  // Throws away the state of an evaluation that was aborted by an error
+  void reset();
 
-  Node run(std::vector<Node> program);
+  // A context for another thread: the same globals, but stacks of its own.
+  // Forking is cheap, since the globals are only copied once one is defined.
+  Interpreter fork() const;
 
-  std::optional<Variable> get_symbol(const std::string &name) const;
-  void add_symbol(const std::string &name, Variable v);
-  void new_scope();
-  void drop_scope();
+  const Variable *get_symbol(SymbolId id) const;
+  void add_symbol(SymbolId id, Variable v);
+
+  std::uint64_t epoch() const { return m_epoch; }
+  CallCache *call_caches(const Chunk &chunk);
+
+  const Node &get_local(std::size_t depth, std::size_t slot) const;
+  const Node &get_local(const Node &ref) const {
+    return get_local(ref.local_depth(), ref.local_slot());
+  }
+  void push_local(Node value) { m_locals.push_back(std::move(value)); }
+  std::size_t locals_size() const { return m_locals.size(); }
+  void enter_frame(std::size_t base) { m_frames.push_back(base); }
+  void truncate_locals(std::size_t size) { m_locals.resize(size); }
+  void leave_frame();
+
+  void defer_call(Variable fn, std::span<Node> args);
+  bool take_deferred_call(Variable &fn, std::vector<Node> &args);
 };
 
-Node collapse(Interpreter &ctx, Node action, std::vector<Node> args);
+// Arguments are moved out of args when that saves a copy
+Node collapse(Interpreter &ctx, const Node &action, std::span<Node> args,
+              bool tail = false);
+
+// Arguments moved off the top of an operand stack, for a call that can run
+// code which grows the same stack and so cannot be given a view into it. The
+// arguments of most calls fit in place here without allocating.
+class CallArgs {
+private:
+  static constexpr std::size_t Inline = 4;
+  Node m_inline[Inline];
+  std::vector<Node> m_spilled;
+  std::span<Node> m_args;
+
+public:
+  explicit CallArgs(std::span<Node> top) {
+    if (top.size() <= Inline) {
+      std::move(top.begin(), top.end(), m_inline);
+      m_args = {m_inline, top.size()};
+    } else {
+      m_spilled.assign(std::make_move_iterator(top.begin()),
+                       std::make_move_iterator(top.end()));
+      m_args = m_spilled;
+    }
+  }
+  CallArgs(const CallArgs &) = delete;
+  CallArgs &operator=(const CallArgs &) = delete;
+
+  std::span<Node> get() { return m_args; }
+};
@@ -0,0 +1,658 @@
+#include "jit.hpp"
+#include "core.hpp"
+#include "expr.hpp"
+#include "interpreter.hpp"
+#include "number.hpp"
+#include "parser.hpp"
+#include "variable.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define LISPY_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Native code never recurses further than this below where it was entered
+constexpr std::int32_t StackLimit = 256 * 1024;
+
+// Only functions of this many parameters or fewer are compiled
+constexpr std::size_t MaxParams = 8;
+
+// Native code that bails out of more than a quarter of its runs, once it has
+// bailed out this many times, is not worth running any more
+constexpr std::uint32_t MinBails = 16;
+
+// General purpose registers, numbered the way instructions encode them
+enum Reg : std::uint8_t {
+  Rax = 0,
+  Rcx = 1,
+  Rdx = 2,
+  Rbx = 3,
+  Rsp = 4,
+  Rbp = 5,
+  Rsi = 6,
+  Rdi = 7,
+  R12 = 12,
+  R13 = 13,
+};
+
+// Condition codes, as the low nibble of jcc and setcc
+enum Cond : std::uint8_t {
+  Overflow = 0x0,
+  Below = 0x2,
+  Equal = 0x4,
+  NotEqual = 0x5,
+  Less = 0xc,
+  Greater = 0xf,
+};
+
+// Just enough of x86-64 for what the compiler emits, all on 64-bit registers
+class Assembler {
+public:
+  using Label = std::size_t;
+
+  std::vector<std::uint8_t> code;
+
+  Label label() {
+    m_labels.push_back({});
+    return m_labels.size() - 1;
+  }
+
+  void bind(Label label) { m_labels[label].at = code.size(); }
+
+  // Fills in the jumps and calls to every label
+  void link() {
+    for (const auto &label : m_labels) {
+      for (auto use : label.uses) {
+        auto rel = (std::int32_t)(label.at - (use + 4));
+        std::memcpy(code.data() + use, &rel, sizeof(rel));
+      }
+    }
+  }
+
+  void push(Reg reg) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0x50 | (reg & 7));
+  }
+
+  void pop(Reg reg) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0x58 | (reg & 7));
+  }
+
+  void mov(Reg dst, Reg src) { rr(0x89, dst, src); }
+
+  void mov(Reg dst, std::int64_t value) {
+    if (value >= std::numeric_limits<std::int32_t>::min() &&
+        value <= std::numeric_limits<std::int32_t>::max()) {
+      rex(Rax, dst);
+      byte(0xc7);
+      modrm(0, dst);
+      imm32((std::int32_t)value);
+      return;
+    }
+    rex(Rax, dst);
+    byte(0xb8 | (dst & 7));
+    std::uint8_t bytes[8];
+    std::memcpy(bytes, &value, sizeof(value));
+    for (auto b : bytes) {
+      byte(b);
+    }
+  }
+
+  // dst = [base + offset]
+  void load(Reg dst, Reg base, std::int32_t offset) {
+    rex(dst, base);
+    byte(0x8b);
+    memory(dst, base, offset);
+  }
+
+  // [base + offset] = src
+  void store(Reg base, std::int32_t offset, Reg src) {
+    rex(src, base);
+    byte(0x89);
+    memory(src, base, offset);
+  }
+
+  void add(Reg dst, Reg src) { rr(0x01, dst, src); }
+  void sub(Reg dst, Reg src) { rr(0x29, dst, src); }
+  void cmp(Reg left, Reg right) { rr(0x39, left, right); }
+  void test(Reg left, Reg right) { rr(0x85, left, right); }
+
+  void imul(Reg dst, Reg src) {
+    rex(dst, src);
+    bytes({0x0f, 0xaf});
+    modrm(dst, src);
+  }
+
+  void neg(Reg reg) { group(0xf7, 3, reg); }
+
+  // rdx:rax / reg, the quotient in rax and the remainder in rdx
+  void idiv(Reg reg) {
+    bytes({0x48, 0x99}); // cqo
+    group(0xf7, 7, reg);
+  }
+
+  void add(Reg dst, std::int32_t value) { arith_imm(0, dst, value); }
+  void sub(Reg dst, std::int32_t value) { arith_imm(5, dst, value); }
+  void cmp(Reg left, std::int32_t value) { arith_imm(7, left, value); }
+
+  // rax = 1 when cond holds, 0 otherwise
+  void set(Cond cond) {
+    bytes({0x0f, (std::uint8_t)(0x90 | cond), 0xc0}); // setcc al
+    bytes({0x0f, 0xb6, 0xc0});                        // movzx eax, al
+  }
+
+  void jump(Label target) {
+    byte(0xe9);
+    rel32(target);
+  }
+
+  void jump(Cond cond, Label target) {
+    bytes({0x0f, (std::uint8_t)(0x80 | cond)});
+    rel32(target);
+  }
+
+  void call(Label target) {
+    byte(0xe8);
+    rel32(target);
+  }
+
+  void ret() { byte(0xc3); }
+
+private:
+  struct Target {
+    std::size_t at = 0;
+    std::vector<std::size_t> uses;
+  };
+
+  std::vector<Target> m_labels;
+
+  void byte(std::uint8_t b) { code.push_back(b); }
+
+  void bytes(std::initializer_list<std::uint8_t> bs) {
+    code.insert(code.end(), bs);
+  }
+
+  void imm32(std::int32_t value) {
+    std::uint8_t bytes[4];
+    std::memcpy(bytes, &value, sizeof(value));
+    for (auto b : bytes) {
+      byte(b);
+    }
+  }
+
+  void rel32(Label target) {
+    m_labels[target].uses.push_back(code.size());
+    imm32(0);
+  }
+
+  void rex(Reg reg, Reg rm) { byte(0x48 | (reg >= 8) << 2 | (rm >= 8)); }
+
+  void modrm(std::uint8_t reg, Reg rm) {
+    byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+  }
+
+  // [base + disp32], which needs a SIB byte when base is rsp or r12
+  void memory(Reg reg, Reg base, std::int32_t offset) {
+    byte(0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == Rsp) {
+      byte(0x24);
+    }
+    imm32(offset);
+  }
+
+  // op r/m64, r64
+  void rr(std::uint8_t opcode, Reg rm, Reg reg) {
+    rex(reg, rm);
+    byte(opcode);
+    modrm(reg, rm);
+  }
+
+  // One of the instructions that share an opcode, told apart by ext
+  void group(std::uint8_t opcode, std::uint8_t ext, Reg rm) {
+    rex(Rax, rm);
+    byte(opcode);
+    modrm(ext, rm);
+  }
+
+  void arith_imm(std::uint8_t ext, Reg rm, std::int32_t value) {
+    group(0x81, ext, rm);
+    imm32(value);
+  }
+};
+
+enum class Type { Int, Bool };
+
+} // namespace
+
+// Turns the resolved body of a function into native code. Every expression
+// leaves its value in rax, as a 64-bit integer or a bool that is 0 or 1, and
+// keeps the values it is still working with on the machine stack. A call
+// passes its arguments on the stack too, pointed to by rdi, and the callee
+// keeps that pointer in rbp.
+//
+// The code for the body is wrapped in an entry point that can be called from
+// C++ (see Jit::Entry), which saves the stack pointer in rbx so that a bail
+// out from any depth can get straight back to it, and the stack limit in r13.
+class Jit::Compiler {
+private:
+  // The body of the function
+  const Expr &m_expr;
+  Assembler &m_asm;
+  SymbolId m_self;
+  std::size_t m_nparams;
+  // What the function is assumed to return, which its calls to itself give
+  Type m_result;
+  Assembler::Label m_bail;
+  Assembler::Label m_body;
+  Assembler::Label m_loop;
+
+  std::optional<Type> expression(const Expr &expr, bool tail) {
+    if (expr.is_form()) {
+      return form(expr, tail);
+    }
+    return atom(expr.node);
+  }
+
+  std::optional<Type> atom(const Node &node) {
+    switch (node.type) {
+    case Node::Local:
+      if (node.local_depth() != 0 || node.local_slot() >= m_nparams) {
+        return std::nullopt;
+      }
+      m_asm.load(Rax, Rbp, (std::int32_t)(node.local_slot() * 8));
+      return Type::Int;
+    case Node::Number: {
+      auto kind = Num::kind(node.value);
+      if (kind != Num::Small && kind != Num::Wide) {
+        return std::nullopt;
+      }
+      m_asm.mov(Rax, kind == Num::Small ? node.as<int>()
+                                        : node.as<Int64>().value);
+      return Type::Int;
+    }
+    case Node::Bool:
+      m_asm.mov(Rax, node.as<bool>() ? 1 : 0);
+      return Type::Bool;
+    default:
+      return std::nullopt;
+    }
+  }
+
+  std::optional<Type> form(const Expr &expr, bool tail) {
+    const auto &head = expr.head().node;
+    auto args = expr.args();
+
+    switch (head.type) {
+    case Node::Keyword:
+      if (head.as<Keyword>() != Keyword::If) {
+        return std::nullopt;
+      }
+      return if_form(expr, tail);
+    case Node::Operator:
+      return operator_form(head.as<char>(), args);
+    case Node::Global: {
+      auto name = head.as<SymbolId>();
+      if (name == m_self) {
+        return self_call(args, tail);
+      }
+      auto index = find_builtin(name);
+      if (index && builtin(*index).name == "rem") {
+        return operator_form('%', args);
+      }
+      return std::nullopt;
+    }
+    default:
+      // (x) or (5)
+      if (!args.empty()) {
+        return std::nullopt;
+      }
+      return atom(head);
+    }
+  }
+
+  std::optional<Type> if_form(const Expr &expr, bool tail) {
+    auto to_else = m_asm.label();
+    auto to_end = m_asm.label();
+
+    if (expression(expr.items[1], false) != Type::Bool) {
+      return std::nullopt;
+    }
+    m_asm.test(Rax, Rax);
+    m_asm.jump(Equal, to_else);
+    auto truthy = expression(expr.items[2], tail);
+    m_asm.jump(to_end);
+    m_asm.bind(to_else);
+    auto falsey = expression(expr.items[3], tail);
+    m_asm.bind(to_end);
+
+    if (!truthy || truthy != falsey) {
+      return std::nullopt;
+    }
+    return truthy;
+  }
+
+  // Arguments are evaluated into rax one after the other, with the ones
+  // before on the stack. % stands for rem.
+  std::optional<Type> operator_form(char op, std::span<const Expr> args) {
+    std::size_t count = 0;
+    for (const auto &arg : args) {
+      if (count > 0) {
+        m_asm.push(Rax);
+      }
+      if (expression(arg, false) != Type::Int) {
+        return std::nullopt;
+      }
+      if (count > 0) {
+        m_asm.mov(Rcx, Rax);
+        m_asm.pop(Rax);
+        if (!binary(op)) {
+          return std::nullopt;
+        }
+      }
+      ++count;
+    }
+
+    switch (op) {
+    case '+':
+    case '*':
+      if (count == 0) {
+        m_asm.mov(Rax, op == '+' ? 0 : 1);
+      }
+      return Type::Int;
+    case '-':
+      if (count == 0) {
+        return std::nullopt;
+      }
+      if (count == 1) {
+        m_asm.neg(Rax);
+        m_asm.jump(Overflow, m_bail);
+      }
+      return Type::Int;
+    case '/':
+    case '%':
+      return count == 2 ? std::optional(Type::Int) : std::nullopt;
+    case '<':
+    case '>':
+    case '=':
+      return count == 2 ? std::optional(Type::Bool) : std::nullopt;
+    default:
+      return std::nullopt;
+    }
+  }
+  // rax = rax op rcx
+  bool binary(char op) {
+    switch (op) {
+    case '+':
+      m_asm.add(Rax, Rcx);
+      m_asm.jump(Overflow, m_bail);
+      return true;
+    case '-':
+      m_asm.sub(Rax, Rcx);
+      m_asm.jump(Overflow, m_bail);
+      return true;
+    case '*':
+      m_asm.imul(Rax, Rcx);
+      m_asm.jump(Overflow, m_bail);
+      return true;
+    case '<':
+    case '>':
+    case '=':
+      m_asm.cmp(Rax, Rcx);
+      m_asm.set(op == '<' ? Less : op == '>' ? Greater : Equal);
+      return true;
+    case '/':
+    case '%':
+      divide(op == '%');
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Division by zero throws, so the interpreter has to do it. Dividing by -1
+  // is negation, which idiv would trap on for the smallest integer.
+  void divide(bool remainder) {
+    auto to_divide = m_asm.label();
+    auto to_end = m_asm.label();
+
+    m_asm.test(Rcx, Rcx);
+    m_asm.jump(Equal, m_bail);
+    m_asm.cmp(Rcx, -1);
+    m_asm.jump(NotEqual, to_divide);
+    if (remainder) {
+      m_asm.mov(Rax, 0);
+    } else {
+      m_asm.neg(Rax);
+      m_asm.jump(Overflow, m_bail);
+    }
+    m_asm.jump(to_end);
+
+    m_asm.bind(to_divide);
+    m_asm.idiv(Rcx);
+    if (remainder) {
+      m_asm.mov(Rax, Rdx);
+    }
+    m_asm.bind(to_end);
+  }
+
+  // The arguments go on the stack last first, so that the first one ends up
+  // lowest, where the callee expects it. A tail call copies them over its own
+  // and starts the body again.
+  std::optional<Type> self_call(std::span<const Expr> args, bool tail) {
+    if (args.size() != m_nparams) {
+      return std::nullopt;
+    }
+
+    for (auto i = args.size(); i-- > 0;) {
+      if (expression(args[i], false) != Type::Int) {
+        return std::nullopt;
+      }
+      m_asm.push(Rax);
+    }
+
+    if (tail) {
+      for (std::size_t i = 0; i < args.size(); i++) {
+        m_asm.pop(Rax);
+        m_asm.store(Rbp, (std::int32_t)(i * 8), Rax);
+      }
+      m_asm.jump(m_loop);
+      return m_result;
+    }
+
+    m_asm.mov(Rdi, Rsp);
+    m_asm.call(m_body);
+    if (!args.empty()) {
+      m_asm.add(Rsp, (std::int32_t)(args.size() * 8));
+    }
+    return m_result;
+  }
+
+  // Restores what the entry point saved and returns to C++
+  void epilogue() {
+    m_asm.pop(R13);
+    m_asm.pop(R12);
+    m_asm.pop(Rbp);
+    m_asm.pop(Rbx);
+    m_asm.ret();
+  }
+
+public:
+  Compiler(const Expr &body, Assembler &as, SymbolId self,
+           std::size_t nparams, Type result)
+      : m_expr(body), m_asm(as), m_self(self), m_nparams(nparams),
+        m_result(result), m_bail(as.label()), m_body(as.label()),
+        m_loop(as.label()) {}
+
+  // The whole function, entry point first. Fails unless the body returns
+  // what it was assumed to.
+  bool function() {
+    m_asm.push(Rbx);
+    m_asm.push(Rbp);
+    m_asm.push(R12);
+    m_asm.push(R13);
+    m_asm.mov(R12, Rsi);
+    m_asm.mov(Rbx, Rsp);
+    m_asm.mov(R13, Rsp);
+    m_asm.sub(R13, StackLimit);
+    m_asm.call(m_body);
+    m_asm.store(R12, 0, Rax);
+    m_asm.mov(Rax, 1);
+    epilogue();
+
+    m_asm.bind(m_bail);
+    m_asm.mov(Rsp, Rbx);
+    m_asm.mov(Rax, 0);
+    epilogue();
+
+    m_asm.bind(m_body);
+    m_asm.cmp(Rsp, R13);
+    m_asm.jump(Below, m_bail);
+    m_asm.push(Rbp);
+    m_asm.mov(Rbp, Rdi);
+    m_asm.bind(m_loop);
+    if (expression(m_expr, true) != m_result) {
+      return false;
+    }
+    m_asm.pop(Rbp);
+    m_asm.ret();
+
+    m_asm.link();
+    return true;
+  }
+};
+
+Jit::~Jit() {
+#ifdef LISPY_JIT
+  if (m_code != nullptr) {
+    munmap(m_code, m_size);
+  }
+#endif
+}
+
+std::optional<Node> Jit::call(const Interpreter &ctx, const Function &func,
+                              SymbolId name, std::span<const Node> args) {
+  auto state = m_state.load(std::memory_order_acquire);
+  if (state == State::Counting) {
+    // Calls racing on another thread may go uncounted, which only means the
+    // function takes a little longer to get hot
+    auto calls = m_calls.load(std::memory_order_relaxed) + 1;
+    m_calls.store(calls, std::memory_order_relaxed);
+    if (calls < Threshold) {
+      return std::nullopt;
+    }
+    compile(func, name);
+    state = m_state.load(std::memory_order_acquire);
+  }
+  if (state != State::Compiled) {
+    return std::nullopt;
+  }
+
+  // Calls to itself were compiled to go straight back into the same code,
+  // which is only right while name still refers to this function
+  const auto *sym = ctx.get_symbol(name);
+  if (sym == nullptr || sym->type != Variable::Function ||
+      &sym->as<Function>() != &func) {
+    return std::nullopt;
+  }
+  return run(args);
+}
+
+void Jit::compile(const Function &func, SymbolId name) {
+  std::lock_guard<std::mutex> lock(m_lock);
+  if (m_state.load(std::memory_order_relaxed) != State::Counting) {
+    return;
+  }
+
+#ifdef LISPY_JIT
+  auto nparams = func.params.size();
+  if (nparams <= MaxParams) {
+    for (auto result : {Type::Int, Type::Bool}) {
+      Assembler as;
+      Compiler compiler{func.body, as, name, nparams, result};
+      if (!compiler.function()) {
+        continue;
+      }
+
+      auto page = (std::size_t)sysconf(_SC_PAGESIZE);
+      auto size = (as.code.size() + page - 1) / page * page;
+      auto *code = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (code == MAP_FAILED) {
+        break;
+      }
+      std::memcpy(code, as.code.data(), as.code.size());
+      if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        break;
+      }
+
+      m_code = code;
+      m_size = size;
+      m_entry = reinterpret_cast<Entry>(code);
+      m_nparams = nparams;
+      m_returns_bool = result == Type::Bool;
+      m_state.store(State::Compiled, std::memory_order_release);
+      return;
+    }
+  }
+#else
+  (void)func;
+  (void)name;
+#endif
+
+  m_state.store(State::Failed, std::memory_order_release);
+}
+
+std::optional<Node> Jit::run(std::span<const Node> args) {
+  if (args.size() < m_nparams) {
+    return std::nullopt;
+  }
+
+  std::int64_t values[MaxParams];
+  for (std::size_t i = 0; i < m_nparams; i++) {
+    const auto &arg = args[i];
+    if (arg.type != Node::Number) {
+      return std::nullopt;
+    }
+    if (Num::is_small(arg.value)) {
+      values[i] = arg.as<int>();
+    } else if (arg.value.is<Int64>()) {
+      values[i] = arg.as<Int64>().value;
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  auto runs = m_runs.load(std::memory_order_relaxed) + 1;
+  m_runs.store(runs, std::memory_order_relaxed);
+
+  std::int64_t result;
+  if (!m_entry(values, &result)) {
+    auto bails = m_bails.load(std::memory_order_relaxed) + 1;
+    m_bails.store(bails, std::memory_order_relaxed);
+    if (bails >= MinBails && bails > runs / 4) {
+      m_state.store(State::Failed, std::memory_order_release);
+    }
+    return std::nullopt;
+  }
+
+  if (m_returns_bool) {
+    return Node{Node::Bool, result != 0};
+  }
+  return Node{Node::Number, Num::from(result)};
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "node.hpp"
+#include "symbol.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+
+class Interpreter;
+struct Function;
+
+// Native x86-64 code for a hot defn. Every user function has one of these,
+// shared by every copy of it, which counts the calls made to it. Once there
+// have been Threshold of them, the body is compiled if it only does integer
+// arithmetic (+ - * / rem), comparisons, if and calls to the function itself.
+// Tail calls to itself become jumps.
+//
+// The native code works on 64-bit integers and bails out, back to the
+// interpreter, whenever it cannot carry on exactly: an argument that is not an
+// integer that fits in 64 bits, an overflow, a division by zero, or recursion
+// too deep for the native stack. The body has no side effects, so the
+// interpreter can then make the whole call over again as if nothing had run.
+class Jit {
+public:
+  static constexpr std::uint32_t Threshold = 1000;
+
+  Jit() = default;
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+  ~Jit();
+
+  // Counts a call of func, which is bound to name, and runs its native code
+  // on args if there is some by now. Returns nullopt when the interpreter has
+  // to make the call instead.
+  std::optional<Node> call(const Interpreter &ctx, const Function &func,
+                           SymbolId name, std::span<const Node> args);
+
+private:
+  class Compiler;
+
+  enum class State : std::uint8_t { Counting, Compiled, Failed };
+
+  // bool entry(std::int64_t *args, std::int64_t *result), false on a bail
+  using Entry = bool (*)(std::int64_t *, std::int64_t *);
+
+  std::atomic<std::uint32_t> m_calls{0};
+  std::atomic<State> m_state{State::Counting};
+  std::atomic<std::uint32_t> m_runs{0};
+  std::atomic<std::uint32_t> m_bails{0};
+  std::mutex m_lock;
+
+  // Only written before m_state becomes Compiled
+  Entry m_entry = nullptr;
+  void *m_code = nullptr;
+  std::size_t m_size = 0;
+  std::size_t m_nparams = 0;
+  bool m_returns_bool = false;
+
+  void compile(const Function &func, SymbolId name);
+  std::optional<Node> run(std::span<const Node> args);
+};
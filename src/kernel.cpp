@@ -0,0 +1,705 @@
+#include "kernel.hpp"
+#include "expr.hpp"
+#include "interpreter.hpp"
+#include "number.hpp"
+#include "symbol.hpp"
+#include "variable.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define LISPY_X86
+#include <immintrin.h>
+#define LISPY_AVX2 __attribute__((target("avx2")))
+#define LISPY_SSE41 __attribute__((target("sse4.1")))
+#endif
+
+namespace {
+
+// Kernels only run where nothing overflows, but the scalar operations still
+// wrap like the vector ones rather than leave it undefined
+std::int32_t wrap(std::uint32_t value) { return (std::int32_t)value; }
+
+struct AddOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) {
+    return wrap((std::uint32_t)x + (std::uint32_t)y);
+  }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_add_epi32(x, y);
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_add_epi32(x, y);
+  }
+#endif
+};
+
+struct SubOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) {
+    return wrap((std::uint32_t)x - (std::uint32_t)y);
+  }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_sub_epi32(x, y);
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_sub_epi32(x, y);
+  }
+#endif
+};
+
+struct MulOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) {
+    return wrap((std::uint32_t)x * (std::uint32_t)y);
+  }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_mullo_epi32(x, y);
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_mullo_epi32(x, y);
+  }
+#endif
+};
+
+// Comparisons leave 1 or 0 behind rather than a full lane mask
+struct LtOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) { return x < y; }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpgt_epi32(y, x), _mm256_set1_epi32(1));
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_and_si128(_mm_cmplt_epi32(x, y), _mm_set1_epi32(1));
+  }
+#endif
+};
+
+struct GtOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) { return x > y; }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpgt_epi32(x, y), _mm256_set1_epi32(1));
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_and_si128(_mm_cmpgt_epi32(x, y), _mm_set1_epi32(1));
+  }
+#endif
+};
+
+struct EqOp {
+  static std::int32_t scalar(std::int32_t x, std::int32_t y) { return x == y; }
+#ifdef LISPY_X86
+  LISPY_AVX2 static __m256i avx2(__m256i x, __m256i y) {
+    return _mm256_and_si256(_mm256_cmpeq_epi32(x, y), _mm256_set1_epi32(1));
+  }
+  LISPY_SSE41 static __m128i sse41(__m128i x, __m128i y) {
+    return _mm_and_si128(_mm_cmpeq_epi32(x, y), _mm_set1_epi32(1));
+  }
+#endif
+};
+
+// a[i] = a[i] op b[i]
+using BinaryFn = void (*)(std::int32_t *, const std::int32_t *, std::size_t);
+
+template <typename Op>
+void binary_scalar(std::int32_t *a, const std::int32_t *b, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) {
+    a[i] = Op::scalar(a[i], b[i]);
+  }
+}
+
+#ifdef LISPY_X86
+template <typename Op>
+LISPY_AVX2 void binary_avx2(std::int32_t *a, const std::int32_t *b,
+                            std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto x = _mm256_loadu_si256((const __m256i *)(a + i));
+    auto y = _mm256_loadu_si256((const __m256i *)(b + i));
+    _mm256_storeu_si256((__m256i *)(a + i), Op::avx2(x, y));
+  }
+  binary_scalar<Op>(a + i, b + i, n - i);
+}
+
+template <typename Op>
+LISPY_SSE41 void binary_sse41(std::int32_t *a, const std::int32_t *b,
+                              std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto x = _mm_loadu_si128((const __m128i *)(a + i));
+    auto y = _mm_loadu_si128((const __m128i *)(b + i));
+    _mm_storeu_si128((__m128i *)(a + i), Op::sse41(x, y));
+  }
+  binary_scalar<Op>(a + i, b + i, n - i);
+}
+#endif
+
+// Sums 64-bit values into out, as long as they all fit in 32 bits (so that
+// fewer than 2^32 of them cannot overflow), and returns whether they did
+using SumFn = bool (*)(const std::int64_t *, std::size_t, std::int64_t &);
+
+constexpr std::int64_t SumBias = std::int64_t(1) << 31;
+
+bool sum_scalar(const std::int64_t *values, std::size_t n, std::int64_t &out) {
+  std::uint64_t sum = 0;
+  std::uint64_t bits = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    sum += (std::uint64_t)values[i];
+    bits |= (std::uint64_t)values[i] + SumBias;
+  }
+  out = (std::int64_t)sum;
+  return bits >> 32 == 0;
+}
+
+#ifdef LISPY_X86
+LISPY_AVX2 bool sum_avx2(const std::int64_t *values, std::size_t n,
+                         std::int64_t &out) {
+  auto sum = _mm256_setzero_si256();
+  auto bits = _mm256_setzero_si256();
+  auto bias = _mm256_set1_epi64x(SumBias);
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    auto x = _mm256_loadu_si256((const __m256i *)(values + i));
+    sum = _mm256_add_epi64(sum, x);
+    bits = _mm256_or_si256(bits, _mm256_add_epi64(x, bias));
+  }
+  std::int64_t sums[4], ors[4];
+  _mm256_storeu_si256((__m256i *)sums, sum);
+  _mm256_storeu_si256((__m256i *)ors, bits);
+  std::int64_t rest;
+  bool narrow = sum_scalar(values + i, n - i, rest);
+  out = (std::int64_t)((std::uint64_t)sums[0] + sums[1] + sums[2] + sums[3] +
+                       rest);
+  return narrow && ((std::uint64_t)(ors[0] | ors[1] | ors[2] | ors[3]) >> 32) ==
+                       0;
+}
+
+LISPY_SSE41 bool sum_sse41(const std::int64_t *values, std::size_t n,
+                           std::int64_t &out) {
+  auto sum = _mm_setzero_si128();
+  auto bits = _mm_setzero_si128();
+  auto bias = _mm_set1_epi64x(SumBias);
+  std::size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    auto x = _mm_loadu_si128((const __m128i *)(values + i));
+    sum = _mm_add_epi64(sum, x);
+    bits = _mm_or_si128(bits, _mm_add_epi64(x, bias));
+  }
+  std::int64_t sums[2], ors[2];
+  _mm_storeu_si128((__m128i *)sums, sum);
+  _mm_storeu_si128((__m128i *)ors, bits);
+  std::int64_t rest;
+  bool narrow = sum_scalar(values + i, n - i, rest);
+  out = (std::int64_t)((std::uint64_t)sums[0] + sums[1] + rest);
+  return narrow && ((std::uint64_t)(ors[0] | ors[1]) >> 32) == 0;
+}
+#endif
+
+struct Isa {
+  const char *name;
+  BinaryFn add, sub, mul, lt, gt, eq;
+  SumFn sum;
+};
+
+constexpr Isa Scalar = {
+    "scalar",
+    binary_scalar<AddOp>,
+    binary_scalar<SubOp>,
+    binary_scalar<MulOp>,
+    binary_scalar<LtOp>,
+    binary_scalar<GtOp>,
+    binary_scalar<EqOp>,
+    sum_scalar,
+};
+
+#ifdef LISPY_X86
+constexpr Isa Avx2 = {
+    "avx2",
+    binary_avx2<AddOp>,
+    binary_avx2<SubOp>,
+    binary_avx2<MulOp>,
+    binary_avx2<LtOp>,
+    binary_avx2<GtOp>,
+    binary_avx2<EqOp>,
+    sum_avx2,
+};
+
+constexpr Isa Sse41 = {
+    "sse4.1",
+    binary_sse41<AddOp>,
+    binary_sse41<SubOp>,
+    binary_sse41<MulOp>,
+    binary_sse41<LtOp>,
+    binary_sse41<GtOp>,
+    binary_sse41<EqOp>,
+    sum_sse41,
+};
+#endif
+
+// The best the CPU supports, unless LISPY_KERNELS names a lesser one
+const Isa &isa() {
+  static const Isa s_isa = [] {
+    const char *env = std::getenv("LISPY_KERNELS");
+    std::string_view cap = env != nullptr ? env : "avx2";
+#ifdef LISPY_X86
+    __builtin_cpu_init();
+    if (cap == "avx2" && __builtin_cpu_supports("avx2")) {
+      return Avx2;
+    }
+    if ((cap == "avx2" || cap == "sse4.1") &&
+        __builtin_cpu_supports("sse4.1")) {
+      return Sse41;
+    }
+#endif
+    return Scalar;
+  }();
+  return s_isa;
+}
+
+const Function *function(const Interpreter &ctx, const Node &fn) {
+  if (fn.type != Node::Global) {
+    return nullptr;
+  }
+  const auto *var = ctx.get_symbol(fn.as<SymbolId>());
+  if (var == nullptr || var->type != Variable::Function) {
+    return nullptr;
+  }
+  return &var->as<Function>();
+}
+
+// The only parameter of a one-parameter function
+bool is_param(const Node &node, std::size_t slot = 0) {
+  return node.type == Node::Local && node.local_depth() == 0 &&
+         node.local_slot() == slot;
+}
+
+} // namespace
+
+// Turns the resolved body of a one-parameter function into postfix code
+class Kernel::Compiler {
+private:
+  const Interpreter &m_ctx;
+  Kernel &m_kernel;
+  std::size_t m_depth = 0;
+
+  void emit(Op op, std::int32_t value = 0) {
+    switch (op) {
+    case Op::Arg:
+    case Op::Const:
+      m_kernel.m_depth = std::max(m_kernel.m_depth, ++m_depth);
+      break;
+    case Op::Neg:
+    case Op::Rem:
+      break;
+    default:
+      --m_depth;
+      break;
+    }
+    m_kernel.m_code.push_back({op, value});
+  }
+
+  bool atom(const Node &node) {
+    if (is_param(node)) {
+      emit(Op::Arg);
+      return true;
+    }
+    if (node.type == Node::Number && Num::is_small(node.value)) {
+      emit(Op::Const, node.as<int>());
+      return true;
+    }
+    return false;
+  }
+
+  bool form(const Expr &expr, bool compare) {
+    const auto &head = expr.head().node;
+    auto args = expr.args();
+
+    if (head.type == Node::Global) {
+      return !compare && rem(head, args);
+    }
+
+    // (x) or (5)
+    if (head.type != Node::Operator) {
+      return !compare && args.empty() && atom(head);
+    }
+
+    for (const auto &arg : args) {
+      if (!expression(arg, false)) {
+        return false;
+      }
+    }
+
+    auto count = args.size();
+    auto op = head.as<char>();
+    switch (op) {
+    case '+':
+    case '*':
+      if (compare) {
+        return false;
+      }
+      if (count == 0) {
+        emit(Op::Const, op == '+' ? 0 : 1);
+      }
+      for (std::size_t i = 1; i < count; i++) {
+        emit(op == '+' ? Op::Add : Op::Mul);
+      }
+      return true;
+    case '-':
+      if (compare || count == 0 || count > 2) {
+        return false;
+      }
+      emit(count == 1 ? Op::Neg : Op::Sub);
+      return true;
+    case '<':
+    case '>':
+    case '=':
+      if (!compare || count != 2) {
+        return false;
+      }
+      emit(op == '<' ? Op::Lt : op == '>' ? Op::Gt : Op::Eq);
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // (rem expr n), as long as n can neither trap nor overflow
+  bool rem(const Node &head, std::span<const Expr> args) {
+    const auto *var = m_ctx.get_symbol(head.as<SymbolId>());
+    if (var == nullptr || var->type != Variable::NativeFn ||
+        var->name != intern("rem") || args.size() != 2 ||
+        !expression(args[0], false) || args[1].is_form() ||
+        args[1].node.type != Node::Number ||
+        !Num::is_small(args[1].node.value)) {
+      return false;
+    }
+    auto divisor = args[1].node.as<int>();
+    if (divisor == 0 || divisor == -1) {
+      return false;
+    }
+    emit(Op::Rem, divisor);
+    return true;
+  }
+
+public:
+  Compiler(const Interpreter &ctx, Kernel &kernel)
+      : m_ctx(ctx), m_kernel(kernel) {}
+
+  // compare says whether this has to be a comparison, the top of a predicate
+  bool expression(const Expr &expr, bool compare) {
+    if (expr.is_form()) {
+      return form(expr, compare);
+    }
+    return !compare && atom(expr.node);
+  }
+};
+
+std::optional<Kernel> Kernel::map(const Interpreter &ctx, const Node &fn) {
+  Kernel kernel;
+
+  if (fn.type == Node::Operator) {
+    // Applied to one number, + and * give it back and - negates it
+    switch (fn.as<char>()) {
+    case '+':
+    case '*':
+      kernel.m_code = {{Op::Arg, 0}};
+      break;
+    case '-':
+      kernel.m_code = {{Op::Arg, 0}, {Op::Neg, 0}};
+      break;
+    default:
+      return std::nullopt;
+    }
+    kernel.m_depth = 1;
+    return kernel;
+  }
+
+  const auto *func = function(ctx, fn);
+  if (func == nullptr || func->params.size() != 1 ||
+      !Compiler(ctx, kernel).expression(func->body, false)) {
+    return std::nullopt;
+  }
+  return kernel;
+}
+
+std::optional<Kernel> Kernel::filter(const Interpreter &ctx, const Node &fn) {
+  Kernel kernel;
+  const auto *func = function(ctx, fn);
+  if (func == nullptr || func->params.size() != 1 ||
+      !Compiler(ctx, kernel).expression(func->body, true)) {
+    return std::nullopt;
+  }
+  return kernel;
+}
+
+void Kernel::binary(Op op, std::int32_t *a, const std::int32_t *b,
+                    std::size_t n) {
+  const auto &ops = isa();
+  switch (op) {
+  case Op::Add:
+    ops.add(a, b, n);
+    break;
+  case Op::Sub:
+    ops.sub(a, b, n);
+    break;
+  case Op::Mul:
+    ops.mul(a, b, n);
+    break;
+  case Op::Lt:
+    ops.lt(a, b, n);
+    break;
+  case Op::Gt:
+    ops.gt(a, b, n);
+    break;
+  case Op::Eq:
+    ops.eq(a, b, n);
+    break;
+  default:
+    break;
+  }
+}
+
+void Kernel::binary(Op op, std::int64_t *a, const std::int64_t *b,
+                    std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) {
+    switch (op) {
+    case Op::Add:
+      a[i] += b[i];
+      break;
+    case Op::Sub:
+      a[i] -= b[i];
+      break;
+    case Op::Mul:
+      a[i] *= b[i];
+      break;
+    case Op::Lt:
+      a[i] = a[i] < b[i];
+      break;
+    case Op::Gt:
+      a[i] = a[i] > b[i];
+      break;
+    case Op::Eq:
+      a[i] = a[i] == b[i];
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+template <typename T>
+const T *Kernel::run(const T *values, std::size_t n,
+                     std::vector<T> &stack) const {
+  stack.resize(m_depth * Block);
+
+  std::size_t top = 0;
+  auto block = [&](std::size_t i) { return stack.data() + i * Block; };
+
+  for (const auto &instr : m_code) {
+    switch (instr.op) {
+    case Op::Arg:
+      std::memcpy(block(top++), values, n * sizeof(T));
+      break;
+    case Op::Const:
+      std::fill_n(block(top++), n, instr.value);
+      break;
+    case Op::Neg: {
+      auto *a = block(top - 1);
+      for (std::size_t i = 0; i < n; i++) {
+        a[i] = -a[i];
+      }
+      break;
+    }
+    case Op::Rem: {
+      // No vector instruction divides, but this still skips collapse()
+      auto *a = block(top - 1);
+      for (std::size_t i = 0; i < n; i++) {
+        a[i] %= instr.value;
+      }
+      break;
+    }
+    default:
+      --top;
+      binary(instr.op, block(top - 1), block(top), n);
+      break;
+    }
+  }
+
+  return block(0);
+}
+
+void Kernel::apply(std::int32_t *values, std::size_t n) const {
+  std::memcpy(values, run(values, n, m_stack), n * sizeof(std::int32_t));
+}
+
+void Kernel::apply(std::int64_t *values, std::size_t n) const {
+  std::memcpy(values, run(values, n, m_wide_stack), n * sizeof(std::int64_t));
+}
+
+std::optional<Kernel::Lanes> Kernel::lanes(std::int64_t &lo,
+                                           std::int64_t &hi) const {
+  struct Range {
+    std::int64_t lo, hi;
+  };
+  std::vector<Range> stack;
+  auto lanes = Lanes::Narrow;
+
+  // Range arithmetic, which only has to be exact while nothing overflows
+  bool overflow = false;
+  auto add = [&](std::int64_t x, std::int64_t y) {
+    std::int64_t out;
+    overflow |= __builtin_add_overflow(x, y, &out);
+    return out;
+  };
+  auto sub = [&](std::int64_t x, std::int64_t y) {
+    std::int64_t out;
+    overflow |= __builtin_sub_overflow(x, y, &out);
+    return out;
+  };
+  auto mul = [&](std::int64_t x, std::int64_t y) {
+    std::int64_t out;
+    overflow |= __builtin_mul_overflow(x, y, &out);
+    return out;
+  };
+
+  for (const auto &instr : m_code) {
+    switch (instr.op) {
+    case Op::Arg:
+      stack.push_back({lo, hi});
+      break;
+    case Op::Const:
+      stack.push_back({instr.value, instr.value});
+      break;
+    case Op::Neg:
+      stack.back() = {sub(0, stack.back().hi), sub(0, stack.back().lo)};
+      break;
+    case Op::Rem: {
+      // Smaller than the divisor, with the sign of the dividend
+      auto max = std::abs((std::int64_t)instr.value) - 1;
+      auto &a = stack.back();
+      a = {a.lo < 0 ? -max : 0, a.hi > 0 ? max : 0};
+      break;
+    }
+    default: {
+      auto b = stack.back();
+      stack.pop_back();
+      auto &a = stack.back();
+      switch (instr.op) {
+      case Op::Add:
+        a = {add(a.lo, b.lo), add(a.hi, b.hi)};
+        break;
+      case Op::Sub:
+        a = {sub(a.lo, b.hi), sub(a.hi, b.lo)};
+        break;
+      case Op::Mul: {
+        std::int64_t products[] = {mul(a.lo, b.lo), mul(a.lo, b.hi),
+                                   mul(a.hi, b.lo), mul(a.hi, b.hi)};
+        a = {*std::min_element(products, products + 4),
+             *std::max_element(products, products + 4)};
+        break;
+      }
+      default:
+        a = {0, 1};
+        break;
+      }
+      break;
+    }
+    }
+
+    if (overflow) {
+      return std::nullopt;
+    }
+    const auto &top = stack.back();
+    if (top.lo < std::numeric_limits<std::int32_t>::min() ||
+        top.hi > std::numeric_limits<std::int32_t>::max()) {
+      lanes = Lanes::Wide;
+    }
+  }
+
+  lo = stack.back().lo;
+  hi = stack.back().hi;
+  return lanes;
+}
+
+namespace {
+
+// Moves the values whose keep is set to the front
+template <typename T>
+std::size_t compact(T *values, const T *keep, std::size_t n) {
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    if (keep[i]) {
+      values[kept++] = values[i];
+    }
+  }
+  return kept;
+}
+
+} // namespace
+
+std::size_t Kernel::select(std::int32_t *values, std::size_t n) const {
+  return compact(values, run(values, n, m_stack), n);
+}
+
+std::size_t Kernel::select(std::int64_t *values, std::size_t n) const {
+  return compact(values, run(values, n, m_wide_stack), n);
+}
+
+std::optional<Fold> fold_kernel(const Interpreter &ctx, const Node &fn) {
+  char op = 0;
+
+  if (fn.type == Node::Operator) {
+    op = fn.as<char>();
+  } else if (const auto *func = function(ctx, fn)) {
+    // (+ a b) or (* a b), with the parameters either way around
+    const auto &body = func->body.items;
+    if (func->params.size() != 2 || body.size() != 3 ||
+        body[0].node.type != Node::Operator || body[1].is_form() ||
+        body[2].is_form() ||
+        !((is_param(body[1].node, 0) && is_param(body[2].node, 1)) ||
+          (is_param(body[1].node, 1) && is_param(body[2].node, 0)))) {
+      return std::nullopt;
+    }
+    op = body[0].node.as<char>();
+  }
+
+  switch (op) {
+  case '+':
+    return Fold::Add;
+  case '*':
+    return Fold::Mul;
+  default:
+    return std::nullopt;
+  }
+}
+
+std::size_t fold(Fold kind, std::int64_t &acc, const std::int64_t *values,
+                 std::size_t n) {
+  std::int64_t sum;
+  if (kind == Fold::Add && isa().sum(values, n, sum) &&
+      !__builtin_add_overflow(acc, sum, &sum)) {
+    acc = sum;
+    return n;
+  }
+
+  for (std::size_t i = 0; i < n; i++) {
+    std::int64_t next;
+    bool overflow = kind == Fold::Add
+                        ? __builtin_add_overflow(acc, values[i], &next)
+                        : __builtin_mul_overflow(acc, values[i], &next);
+    if (overflow) {
+      return i;
+    }
+    acc = next;
+  }
+  return n;
+}
+
+const char *kernel_isa() { return isa().name; }
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "node.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+class Interpreter;
+
+// Straight-line integer arithmetic compiled from a function, so that map,
+// filter and reduce can run it over a block of unboxed numbers at a time
+// instead of making one collapse() call per element. A kernel only runs over
+// values that lanes() says it cannot overflow on; anything else takes the
+// promoting path through collapse().
+class Kernel {
+public:
+  static constexpr std::size_t Block = 256;
+
+  // 32-bit lanes use AVX2 or SSE4.1 when the CPU has them, and plain loops
+  // otherwise. 64-bit lanes are for numbers that outgrow those, and always
+  // take plain loops.
+  enum class Lanes { Narrow, Wide };
+
+  // An operator, or a defn of one parameter whose body only applies + - * to
+  // that parameter and number literals (and rem by a literal)
+  static std::optional<Kernel> map(const Interpreter &ctx, const Node &fn);
+  // The same, except that the body is a single < > or = of two such
+  // expressions
+  static std::optional<Kernel> filter(const Interpreter &ctx, const Node &fn);
+
+  // The narrowest lanes that hold everything the function computes from
+  // values between lo and hi, if any do. Narrows lo and hi to the range of
+  // its results.
+  std::optional<Lanes> lanes(std::int64_t &lo, std::int64_t &hi) const;
+
+  // Replaces each of the n values with the function's result
+  void apply(std::int32_t *values, std::size_t n) const;
+  void apply(std::int64_t *values, std::size_t n) const;
+  // Moves the values that pass the predicate to the front, in order, and
+  // returns how many there are
+  std::size_t select(std::int32_t *values, std::size_t n) const;
+  std::size_t select(std::int64_t *values, std::size_t n) const;
+
+private:
+  class Compiler;
+
+  enum class Op : std::uint8_t {
+    Arg,
+    Const,
+    Add,
+    Sub,
+    Mul,
+    Neg,
+    Rem,
+    Lt,
+    Gt,
+    Eq
+  };
+
+  struct Instr {
+    Op op;
+    std::int32_t value;
+  };
+
+  // Postfix, evaluated on a stack of blocks
+  std::vector<Instr> m_code;
+  std::size_t m_depth = 0;
+  mutable std::vector<std::int32_t> m_stack;
+  mutable std::vector<std::int64_t> m_wide_stack;
+
+  static void binary(Op op, std::int32_t *a, const std::int32_t *b,
+                     std::size_t n);
+  static void binary(Op op, std::int64_t *a, const std::int64_t *b,
+                     std::size_t n);
+  template <typename T>
+  const T *run(const T *values, std::size_t n, std::vector<T> &stack) const;
+};
+
+// A reduce function that kernels can fold: + or *, passed as an operator or as
+// a defn of two parameters whose body applies it to both
+enum class Fold { Add, Mul };
+
+std::optional<Fold> fold_kernel(const Interpreter &ctx, const Node &fn);
+// Folds values into acc for as long as the result fits in 64 bits, and
+// returns how many of them it took
+std::size_t fold(Fold kind, std::int64_t &acc, const std::int64_t *values,
+                 std::size_t n);
+
+// The instruction set the block operations picked: "avx2", "sse4.1" or
+// "scalar"
+const char *kernel_isa();
@@ -1,13 +1,122 @@
 #include "list.hpp"
+#include "heap.hpp"
+#include "number.hpp"
 
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
 
-void List::print() {
+namespace {
+
+union Cell {
+  Cell *next_free;
+  alignas(List) unsigned char storage[sizeof(List)];
+};
+
+constexpr std::size_t SlabCells = 1024;
+
+// Hands out cells from the newest slab in address order and recycles freed
+// ones through an intrusive free list
+struct ListPool {
+  std::vector<std::unique_ptr<Cell[]>> slabs;
+  std::size_t slab_used = SlabCells;
+  Cell *free_list = nullptr;
+  std::size_t free = 0;
+  std::size_t live = 0;
+  std::size_t allocations = 0;
+  // Only taken while worker threads share the heap
+  std::mutex lock;
+
+  void *allocate() {
+    ++live;
+    ++allocations;
+
+    if (free_list != nullptr) {
+      auto *cell = free_list;
+      free_list = cell->next_free;
+      --free;
+      return cell;
+    }
+
+    if (slab_used == SlabCells) {
+      slabs.emplace_back(new Cell[SlabCells]);
+      slab_used = 0;
+    }
+    return &slabs.back()[slab_used++];
+  }
+
+  void deallocate(void *ptr) {
+    auto *cell = static_cast<Cell *>(ptr);
+    cell->next_free = free_list;
+    free_list = cell;
+    ++free;
+    --live;
+
+    // Once no list is left, every slab but the newest goes back, so that a
+    // burst of lists does not keep its memory for good
+    if (live == 0) {
+      slabs.erase(slabs.begin(), slabs.end() - 1);
+      slab_used = 0;
+      free_list = nullptr;
+      free = 0;
+    }
+  }
+};
+
+ListPool &pool() {
+  static ListPool s_pool;
+  return s_pool;
+}
+
+} // namespace
+
+List::~List() {
+  // Unlink the rest of the list one cell at a time so that freeing a long
+  // list does not recurse once per cell
+  auto rest = std::move(next);
+  while (rest.unique()) {
+    auto after = std::move(rest->next);
+    rest = std::move(after);
+  }
+}
+
+void *List::operator new(std::size_t size) {
+  if (size != sizeof(List)) {
+    throw std::bad_alloc();
+  }
+  heap_reserve(size);
+  auto &p = pool();
+  if (g_shared_heap) {
+    std::lock_guard guard(p.lock);
+    return p.allocate();
+  }
+  return p.allocate();
+}
+
+void List::operator delete(void *ptr) {
+  heap_release(sizeof(List));
+  auto &p = pool();
+  if (g_shared_heap) {
+    std::lock_guard guard(p.lock);
+    return p.deallocate(ptr);
+  }
+  p.deallocate(ptr);
+}
+
+void List::print(std::ostream &out) {
   List *curr = this;
-  std::cout << "(";
+  out << "(";
   while (curr != nullptr) {
-    std::cout << " " << curr->value;
-    curr = curr->next;
+    out << " ";
+    Num::print(out, curr->value);
+    curr = curr->next.get();
   }
-  std::cout << " )" << std::endl;
+  out << " )" << std::endl;
+}
+
+ListPoolStats list_pool_stats() {
+  const auto &p = pool();
+  return {p.live, p.free, p.slabs.size(), p.allocations};
 }
@@ -1,9 +1,36 @@
 #pragma once
 
-struct List {
+#include "value.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <utility>
+
+// Cons cell. Cells come out of a slab pool, so a list built front to back is
+// laid out contiguously and in order, and are refcounted like any other heap
+// value so that a list is freed once nothing refers to it anymore.
+struct List : HeapObject {
+  static inline const char tag = 0;
+
   // TODO: we may want this to have ids as well
-  int value;
-  List *next = nullptr;
+  Value value = 0;
+  Ref<List> next;
+
+  List() { kind = &tag; }
+  explicit List(Value _value) : value(std::move(_value)) { kind = &tag; }
+  ~List();
 
-  void print();
+  static void *operator new(std::size_t size);
+  static void operator delete(void *ptr);
+
+  void print(std::ostream &out);
+};
+
+struct ListPoolStats {
+  std::size_t live;
+  std::size_t free;
+  std::size_t slabs;
+  std::size_t allocations;
 };
+
+ListPoolStats list_pool_stats();
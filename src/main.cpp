@@ -1,11 +1,37 @@
+#include "image.hpp"
 #include "interpreter.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+#include "server.hpp"
+#include "source.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
-int main(int argc, char **argv) {
+namespace {
+
+void usage() {
+  std::cerr << "usage: lisp [--tree-walk] [--no-jit] [-p|--print]\n"
+               "            [--image in.img]\n"
+               "            [--dump-image out.img] [--profile out.folded]\n"
+               "            [--serve path.sock [--workers n]]\n"
+               "            [file.lisp ... | -]"
+            << std::endl;
+}
+
+int repl(Interpreter &interpreter) {
   std::cout << "lispy v0.0.1" << std::endl;
 
-  Interpreter interpreter;
   std::string line;
   while (true) {
     std::cout << "=> ";
@@ -15,11 +41,140 @@ int main(int argc, char **argv) {
       break;
     }
 
-    auto tokens = parse(line);
-    auto program = interpreter.compile(tokens);
-    auto ret = interpreter.run(program);
+    try {
+      auto tokens = parse(line);
+      auto program = interpreter.compile(tokens);
+      auto ret = interpreter.run(program);
+
+      ret.print(interpreter, std::cout);
+    } catch (const std::exception &e) {
+      std::cout << "error: " << e.what() << std::endl;
+      interpreter.reset();
+    }
+  }
+
+  return 0;
+}
+
+// The --profile profiler, reported on however main() returns
+class ProfileReport {
+private:
+  std::string m_path;
+
+public:
+  Profiler profiler;
+
+  explicit ProfileReport(std::string path) : m_path(std::move(path)) {}
+  ~ProfileReport() {
+    profiler.print(std::cerr);
+    std::ofstream out(m_path);
+    profiler.write_folded(out);
+    if (!out) {
+      std::cerr << "Could not write " << m_path << std::endl;
+    }
+  }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Interpreter interpreter;
+  std::vector<std::string> sources;
+  std::string image;
+  std::string dump_image;
+  std::string profile;
+  std::string serve_path;
+  std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+  bool print = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--tree-walk") == 0) {
+      // Evaluate with the tree walker instead of the bytecode VM
+      interpreter.set_bytecode(false);
+    } else if (std::strcmp(argv[i], "--no-jit") == 0) {
+      // Never compile hot functions to native code
+      interpreter.set_jit(false);
+    } else if (std::strcmp(argv[i], "-p") == 0 ||
+               std::strcmp(argv[i], "--print") == 0) {
+      print = true;
+    } else if (std::strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      // Start from the globals saved by --dump-image instead of empty
+      image = argv[++i];
+    } else if (std::strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc) {
+      // Save the globals once the sources have run, instead of a REPL
+      dump_image = argv[++i];
+    } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      // Time every call, and write the stacks they were made from on exit
+      profile = argv[++i];
+    } else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      // Once the sources have run, answer requests on a socket instead of a
+      // REPL
+      serve_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      workers = std::strtoul(argv[++i], nullptr, 10);
+      if (workers == 0) {
+        usage();
+        return 2;
+      }
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      usage();
+      return 2;
+    } else {
+      sources.push_back(argv[i]);
+    }
+  }
+
+  std::optional<ProfileReport> report;
+  if (!profile.empty()) {
+    report.emplace(profile);
+    interpreter.set_profiler(&report->profiler);
+  }
+
+  if (!image.empty()) {
+    try {
+      load_image(interpreter, image);
+    } catch (const std::exception &e) {
+      std::cerr << image << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (sources.empty() && dump_image.empty() && serve_path.empty()) {
+    return repl(interpreter);
+  }
+
+  std::ostream *out = print ? &std::cout : nullptr;
+  for (const auto &name : sources) {
+    if (name == "-") {
+      std::string source(std::istreambuf_iterator<char>(std::cin), {});
+      if (!run_source(interpreter, "<stdin>", source, out, std::cerr)) {
+        return 1;
+      }
+      continue;
+    }
+
+    try {
+      SourceFile file(name);
+      if (!run_source(interpreter, name, file.view(), out, std::cerr)) {
+        return 1;
+      }
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (!dump_image.empty()) {
+    try {
+      save_image(interpreter, dump_image);
+    } catch (const std::exception &e) {
+      std::cerr << dump_image << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
 
-    ret.print(interpreter);
+  if (!serve_path.empty()) {
+    return serve(interpreter, serve_path, workers);
   }
 
   return 0;
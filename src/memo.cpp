@@ -0,0 +1,99 @@
+#include "memo.hpp"
+#include "bigint.hpp"
+#include "number.hpp"
+#include "value.hpp"
+
+#include <cstdint>
+
+namespace {
+
+template <typename T> void append(Memo::Key &key, T value) {
+  key.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+} // namespace
+
+Memo::Key Memo::key(std::span<const Node> args) {
+  Key key;
+  for (const auto &arg : args) {
+    auto kind = Num::kind(arg.value);
+    key.push_back((char)kind);
+    switch (kind) {
+    case Num::Small:
+      append(key, arg.as<int>());
+      break;
+    case Num::Wide:
+      append(key, arg.as<Int64>().value);
+      break;
+    case Num::Big: {
+      const auto &big = arg.as<BigInt>();
+      append(key, big.negative());
+      append(key, (std::uint32_t)big.limbs().size());
+      for (auto limb : big.limbs()) {
+        append(key, limb);
+      }
+      break;
+    }
+    case Num::Float:
+      append(key, arg.as<double>());
+      break;
+    }
+  }
+  return key;
+}
+
+std::unique_lock<std::mutex> Memo::guard() const {
+  if (g_shared_heap) {
+    return std::unique_lock(m_lock);
+  }
+  return {};
+}
+
+std::optional<Node> Memo::find(const Key &key) {
+  auto lock = guard();
+  auto found = m_index.find(key);
+  if (found == m_index.end()) {
+    ++m_misses;
+    return std::nullopt;
+  }
+  ++m_hits;
+  m_entries.splice(m_entries.begin(), m_entries, found->second);
+  return found->second->second;
+}
+
+void Memo::insert(Key key, Node result) {
+  auto lock = guard();
+  if (m_capacity == 0) {
+    return;
+  }
+
+  // Another call with the same arguments may have finished first
+  auto found = m_index.find(key);
+  if (found != m_index.end()) {
+    found->second->second = std::move(result);
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    return;
+  }
+
+  m_entries.emplace_front(key, std::move(result));
+  m_index.emplace(std::move(key), m_entries.begin());
+  evict();
+}
+
+void Memo::set_capacity(std::size_t capacity) {
+  auto lock = guard();
+  m_capacity = capacity;
+  evict();
+}
+
+Memo::Stats Memo::stats() const {
+  auto lock = guard();
+  return {m_hits, m_misses, m_entries.size(), m_capacity};
+}
+
+void Memo::evict() {
+  while (m_entries.size() > m_capacity) {
+    m_index.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "node.hpp"
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// The results of a function defined with defn_memo, keyed by the arguments
+// they were computed from (which are always numbers). Holds at most capacity
+// results, and forgets the least recently used one to make room for another.
+class Memo {
+public:
+  static constexpr std::size_t DefaultCapacity = 4096;
+
+  // The arguments' kinds and bits, back to back. Integers are always as
+  // narrow as they can be, so equal arguments give equal keys.
+  using Key = std::string;
+
+  struct Stats {
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t size;
+    std::size_t capacity;
+  };
+
+  explicit Memo(std::size_t capacity = DefaultCapacity)
+      : m_capacity(capacity) {}
+
+  static Key key(std::span<const Node> args);
+
+  // Counts as a hit or a miss
+  std::optional<Node> find(const Key &key);
+  void insert(Key key, Node result);
+
+  void set_capacity(std::size_t capacity);
+  Stats stats() const;
+
+private:
+  using Entry = std::pair<Key, Node>;
+
+  // Most recently used first
+  std::list<Entry> m_entries;
+  std::unordered_map<Key, std::list<Entry>::iterator> m_index;
+  std::size_t m_capacity;
+  std::size_t m_hits = 0;
+  std::size_t m_misses = 0;
+  // Only taken while worker threads share the heap
+  mutable std::mutex m_lock;
+
+  std::unique_lock<std::mutex> guard() const;
+  void evict();
+};
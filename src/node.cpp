@@ -1,24 +1,26 @@
 #include "node.hpp"
 #include "interpreter.hpp"
 #include "list.hpp"
+#include "number.hpp"
 #include "parser.hpp"
+#include "seq.hpp"
+#include "symbol.hpp"
 #include "variable.hpp"
 
 #include <iostream>
 
-void Node::print_debug(std::size_t depth) {
+void Node::print_debug(std::size_t depth) const {
   for (std::size_t i = 0; i < depth; i++)
     std::cout << " ";
 
   switch (this->type) {
-  case Node::Paren:
-    std::cout << "PAREN\t\t" << this->as<char>() << std::endl;
-    break;
   case Node::Operator:
     std::cout << "OPER\t\t" << this->as<char>() << std::endl;
     break;
   case Node::Number:
-    std::cout << "NUMBER\t\t" << this->as<int>() << std::endl;
+    std::cout << "NUMBER\t\t";
+    Num::print(std::cout, this->value);
+    std::cout << std::endl;
     break;
   case Node::Bool:
     std::cout << "BOOL\t\t" << this->as<bool>() << std::endl;
@@ -28,61 +30,69 @@ void Node::print_debug(std::size_t depth) {
               << std::endl;
     break;
   case Node::Identifier:
-    std::cout << "IDENT\t\t" << this->as<std::string>() << std::endl;
+    std::cout << "IDENT\t\t" << symbol_name(this->as<SymbolId>())
+              << std::endl;
+    break;
+  case Node::Global:
+    std::cout << "GLOBAL\t\t" << symbol_name(this->as<SymbolId>())
+              << std::endl;
+    break;
+  case Node::Local:
+    std::cout << "LOCAL\t\t" << this->local_depth() << ":"
+              << this->local_slot() << std::endl;
     break;
   case Node::Vec:
     std::cout << "VECTOR\t\t";
-    this->as<Vector>().print();
+    this->as<Vector>().print(std::cout);
     break;
   case Node::List:
     std::cout << "LIST\t\t";
-    this->as<::List *>()->print();
+    this->as<::List *>()->print(std::cout);
     break;
-  case Node::Body: {
-    std::cout << "BODY" << std::endl;
-    auto nodes = this->as<std::vector<Node>>();
-    for (auto &n : nodes) {
-      n.print_debug(depth + 2);
-    }
+  case Node::Seq:
+    std::cout << "SEQ\t\t" << this->as<::Seq>().stages.size() << " stages"
+              << std::endl;
     break;
-  }
   default:
     break;
   }
 }
 
-void Node::print(const Interpreter &ctx) {
+void Node::print(Interpreter &ctx, std::ostream &out) const {
   switch (this->type) {
   case Node::Undefined:
-    std::cout << "undefined" << std::endl;
+    out << "undefined" << std::endl;
     break;
-  case Node::Paren:
   case Node::Operator:
     break;
   case Node::Number:
-    std::cout << this->as<int>() << std::endl;
+    Num::print(out, this->value);
+    out << std::endl;
     break;
   case Node::Bool:
-    std::cout << (this->as<bool>() ? "true" : "false") << std::endl;
+    out << (this->as<bool>() ? "true" : "false") << std::endl;
     break;
   case Node::Keyword:
+  case Node::Local:
     break;
-  case Node::Identifier: {
-    auto name = this->as<std::string>();
-    auto val = ctx.get_symbol(name);
-    if (!val.has_value()) {
-      std::cout << "'" << name << "' is undefined" << std::endl;
+  case Node::Identifier:
+  case Node::Global: {
+    auto id = this->as<SymbolId>();
+    const auto *val = ctx.get_symbol(id);
+    if (val == nullptr) {
+      out << "'" << symbol_name(id) << "' is undefined" << std::endl;
       return;
     }
     switch (val->type) {
     case Variable::Integer:
-      std::cout << val->as<int>() << std::endl;
+      Num::print(out, val->value);
+      out << std::endl;
       break;
     case Variable::Vec:
-      val->as<Vector>().print();
+      val->as<Vector>().print(out);
       break;
     case Variable::List:
-      val->as<::List *>()->print();
+      val->as<::List *>()->print(out);
       break;
     default:
       break;
@@ -90,25 +100,30 @@ void Node::print(const Interpreter &ctx) {
     break;
   }
   case Node::Vec:
-    this->as<Vector>().print();
+    this->as<Vector>().print(out);
     break;
-  case Node::Body: {
+  case Node::Seq:
+    this->as<::Seq>().print(ctx, out);
     break;
-  }
   case Node::List: {
-    this->as<::List *>()->print();
+    if (auto *list = this->as<::List *>()) {
+      list->print(out);
+    } else {
+      out << "( )" << std::endl;
+    }
     break;
   }
   case Node::Symbol: {
-    auto v = this->as<Variable>();
+    const auto &v = this->as<Variable>();
     switch (v.type) {
     case Variable::Function: {
-      auto func = v.as<Function>();
-      std::cout << "#" << v.name << "/" << func.params.data.size() << std::endl;
+      const auto &func = v.as<Function>();
+      out << "#" << symbol_name(v.name) << "/"
+                << func.params.size() << std::endl;
       break;
     }
     default:
-      std::cout << "#" << v.name << std::endl;
+      out << "#" << symbol_name(v.name) << std::endl;
       break;
     }
     break;
@@ -116,34 +131,33 @@ void Node::print(const Interpreter &ctx) {
   }
 }
 
-void Vector::add_element(Token tok) {
+void Vector::add_element(const Token &tok) {
   switch (tok.type) {
   case Token::Number:
-    this->data.push_back({Node::Number, tok.as<int>()});
+    this->push_back({Node::Number, tok.value});
     break;
   case Token::Identifier:
-    this->data.push_back({Node::Identifier, tok.as<std::string>()});
+    this->push_back({Node::Identifier, tok.as<SymbolId>()});
     break;
   default:
-    std::cerr << "Invalid token for vector" << std::endl;
-    break;
+    throw SyntaxError("Invalid token for vector", tok.offset);
   }
 }
 
-void Vector::print() {
-  std::cout << "[";
-  for (auto &node : this->data) {
-    std::cout << " ";
+void Vector::print(std::ostream &out) const {
+  out << "[";
+  for (const auto &node : *this) {
+    out << " ";
     switch (node.type) {
     case Node::Number:
-      std::cout << node.as<int>();
+      Num::print(out, node.value);
       break;
     case Node::Identifier:
-      std::cout << node.as<std::string>();
+      out << symbol_name(node.as<SymbolId>());
       break;
     default:
       break;
     }
   }
-  std::cout << " ]" << std::endl;
+  out << " ]" << std::endl;
 }
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <any>
-#include <functional>
+#include "value.hpp"
+
+#include <iosfwd>
 #include <stdexcept>
 #include <vector>
 
@@ -11,7 +12,6 @@ struct Token;
 struct Node {
   enum Type {
     Undefined,
-    Paren,
     Operator,
     Number,
     Keyword,
@@ -19,22 +19,29 @@ struct Node {
     Bool,
     Vec,
     List,
-    Body,
-    Symbol
-  } type;
-  std::any value;
-
-  ~Node() {
-    if (type == List) {
-      // TODO: delete list
-    }
-  }
+    Symbol,
+    Local,
+    Global,
+    Seq
+  } type = Undefined;
+  Value value;
 
-  template <typename T> T as() { return std::any_cast<T>(value); }
+  Node() = default;
+  Node(Type _type) : type(_type) {}
+  template <typename T>
+  Node(Type _type, T &&_value) : type(_type), value(std::forward<T>(_value)) {}
 
-  template <typename T> T as() const { return std::any_cast<T>(value); }
+  template <typename T> decltype(auto) as() const { return value.as<T>(); }
 
-  Node get_if(Type _type) {
+  // A resolved parameter reference packs its frame depth into the high half
+  // and its slot into the low half of the immediate
+  static Node local(std::size_t depth, std::size_t slot) {
+    return {Local, (int)(depth << 16 | slot)};
+  }
+  std::size_t local_depth() const { return (std::uint32_t)as<int>() >> 16; }
+  std::size_t local_slot() const { return (std::uint32_t)as<int>() & 0xffff; }
+
+  Node get_if(Type _type) const {
     if (_type != type) {
       throw std::runtime_error("Node::get_if() failed");
     }
@@ -42,7 +49,7 @@ struct Node {
   }
 
   Node get_if_or(Type _type, Interpreter &ctx,
-                 std::function<Node(Interpreter &, Node, Node::Type)> fn) {
+                 Node (*fn)(Interpreter &, Node, Node::Type)) const {
     if (_type != type) {
       auto node = fn(ctx, *this, _type);
       if (node.type == Node::Undefined) {
@@ -53,13 +60,86 @@ struct Node {
     return *this;
   }
 
-  void print_debug(std::size_t depth = 0);
-  void print(const Interpreter &ctx);
+  void print_debug(std::size_t depth = 0) const;
+  void print(Interpreter &ctx, std::ostream &out) const;
+};
+
+// Vectors are persistent: a 32-way trie of leaves plus a tail leaf that
+// appends go into, as in Clojure. Copies share all of their structure, and a
+// trie node is only written in place while exactly one vector owns it.
+struct VecLeaf : HeapObject {
+  Node items[32];
 };
 
-struct Vector {
-  std::vector<Node> data;
+struct VecBranch : HeapObject {
+  Ref<HeapObject> children[32];
+};
+
+class Vector {
+public:
+  static constexpr std::size_t Bits = 5;
+  static constexpr std::size_t Width = 1 << Bits;
+  static constexpr std::size_t Mask = Width - 1;
+
+  class const_iterator {
+  public:
+    const_iterator(const Vector *vec, std::size_t index)
+        : m_vec(vec), m_index(index) {}
+
+    const Node &operator*() const {
+      auto raw = m_vec->m_start + m_index;
+      if (m_leaf == nullptr) {
+        m_leaf = m_vec->leaf_for(raw);
+      }
+      return m_leaf->items[raw & Mask];
+    }
+
+    const_iterator &operator++() {
+      if (((m_vec->m_start + ++m_index) & Mask) == 0) {
+        m_leaf = nullptr;
+      }
+      return *this;
+    }
+
+    bool operator!=(const const_iterator &other) const {
+      return m_index != other.m_index;
+    }
+
+  private:
+    const Vector *m_vec;
+    std::size_t m_index;
+    mutable const VecLeaf *m_leaf = nullptr;
+  };
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, m_size}; }
+
+  const Node &operator[](std::size_t index) const;
+
+  void push_back(Node node);
+  Vector assoc(std::size_t index, Node node) const;
+  Vector subvec(std::size_t start, std::size_t end) const;
+  Vector concat(const Vector &other) const;
+
+  // Only numbers and names can be elements; anything else throws a
+  // SyntaxError at tok
+  void add_element(const Token &tok);
+  void print(std::ostream &out) const;
+
+private:
+  Ref<HeapObject> m_root;
+  Ref<HeapObject> m_tail;
+  std::size_t m_shift = Bits;
+  std::size_t m_count = 0;
+
+  // subvec() only narrows this window onto the shared trie
+  std::size_t m_start = 0;
+  std::size_t m_size = 0;
 
-  void add_element(Token tok);
-  void print();
+  std::size_t tail_offset() const;
+  const VecLeaf *leaf_for(std::size_t raw) const;
+  void append(Node node);
+  void set(std::size_t raw, Node node);
 };
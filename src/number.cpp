@@ -0,0 +1,341 @@
+#include "number.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+enum class Op { Add, Sub, Mul };
+
+std::int64_t to_int64(const Value &value) {
+  if (Num::is_small(value)) {
+    return value.as<int>();
+  }
+  return value.as<Int64>().value;
+}
+
+// The value as a BigInt, which only has to be made when it is not one already
+const BigInt &to_big(const Value &value, BigInt &scratch) {
+  if (value.is<BigInt>()) {
+    return value.as<BigInt>();
+  }
+  scratch = BigInt(to_int64(value));
+  return scratch;
+}
+
+bool is_zero(const Value &value) {
+  return Num::is_small(value) && value.as<int>() == 0;
+}
+
+Value float_op(Op op, double a, double b) {
+  switch (op) {
+  case Op::Add:
+    return a + b;
+  case Op::Sub:
+    return a - b;
+  default:
+    return a * b;
+  }
+}
+
+Value arith(Op op, const Value &a, const Value &b) {
+  // Floats have their own fast path, which never looks at the integer kinds
+  if (a.is<double>() && b.is<double>()) {
+    return float_op(op, a.as<double>(), b.as<double>());
+  }
+
+  auto kind = std::max(Num::kind(a), Num::kind(b));
+  if (kind == Num::Float) {
+    return float_op(op, Num::to_double(a), Num::to_double(b));
+  }
+
+  if (kind != Num::Big) {
+    auto x = to_int64(a);
+    auto y = to_int64(b);
+    std::int64_t out;
+    bool overflow = op == Op::Add   ? __builtin_add_overflow(x, y, &out)
+                    : op == Op::Sub ? __builtin_sub_overflow(x, y, &out)
+                                    : __builtin_mul_overflow(x, y, &out);
+    if (!overflow) {
+      return Num::from(out);
+    }
+  }
+
+  BigInt xs, ys;
+  const auto &x = to_big(a, xs);
+  const auto &y = to_big(b, ys);
+  switch (op) {
+  case Op::Add:
+    return Num::from(x + y);
+  case Op::Sub:
+    return Num::from(x - y);
+  default:
+    return Num::from(x * y);
+  }
+}
+
+// Integer division of a by b, which is not zero
+void divmod(const Value &a, const Value &b, Value *quotient,
+            Value *remainder) {
+  if (Num::kind(a) != Num::Big && Num::kind(b) != Num::Big) {
+    auto x = to_int64(a);
+    auto y = to_int64(b);
+    // The only quotient that does not fit
+    if (x != std::numeric_limits<std::int64_t>::min() || y != -1) {
+      if (quotient != nullptr) {
+        *quotient = Num::from(x / y);
+      }
+      if (remainder != nullptr) {
+        *remainder = Num::from(x % y);
+      }
+      return;
+    }
+  }
+
+  BigInt xs, ys, q, r;
+  BigInt::divmod(to_big(a, xs), to_big(b, ys), q, r);
+  if (quotient != nullptr) {
+    *quotient = Num::from(std::move(q));
+  }
+  if (remainder != nullptr) {
+    *remainder = Num::from(std::move(r));
+  }
+}
+
+// Newton's method from above, starting at a power of two that is at least
+// the root
+BigInt isqrt(const BigInt &n) {
+  BigInt x(1);
+  for (std::size_t i = 0; i < n.limbs().size(); i++) {
+    x = x * BigInt(1 << 16);
+  }
+  BigInt two(2), q, r;
+  while (true) {
+    BigInt::divmod(n, x, q, r);
+    BigInt y;
+    BigInt::divmod(x + q, two, y, r);
+    if (compare(y, x) >= 0) {
+      return x;
+    }
+    x = std::move(y);
+  }
+}
+
+} // namespace
+
+namespace Num {
+
+Kind kind(const Value &value) {
+  if (is_small(value)) {
+    return Small;
+  }
+  if (value.is<Int64>()) {
+    return Wide;
+  }
+  if (value.is<BigInt>()) {
+    return Big;
+  }
+  if (value.is<double>()) {
+    return Float;
+  }
+  throw std::runtime_error("Expected a number");
+}
+
+Value from(std::int64_t value) {
+  if (value >= std::numeric_limits<int>::min() &&
+      value <= std::numeric_limits<int>::max()) {
+    return (int)value;
+  }
+  return Int64{value};
+}
+
+Value from(BigInt value) {
+  if (auto small = value.to_int64()) {
+    return from(*small);
+  }
+  return value;
+}
+
+Value from(double value) { return value; }
+
+Value add_slow(const Value &a, const Value &b) { return arith(Op::Add, a, b); }
+
+Value sub_slow(const Value &a, const Value &b) { return arith(Op::Sub, a, b); }
+
+Value mul_slow(const Value &a, const Value &b) { return arith(Op::Mul, a, b); }
+
+Value neg(const Value &a) {
+  switch (kind(a)) {
+  case Small:
+  case Wide:
+    if (to_int64(a) != std::numeric_limits<std::int64_t>::min()) {
+      return from(-to_int64(a));
+    }
+    return from(-BigInt(to_int64(a)));
+  case Big:
+    return from(-a.as<BigInt>());
+  default:
+    return from(-a.as<double>());
+  }
+}
+
+Value div(const Value &a, const Value &b) {
+  if (std::max(kind(a), kind(b)) == Float) {
+    return from(to_double(a) / to_double(b));
+  }
+  if (is_zero(b)) {
+    throw std::runtime_error("Division by zero");
+  }
+  Value quotient;
+  divmod(a, b, &quotient, nullptr);
+  return quotient;
+}
+
+Value rem(const Value &a, const Value &b) {
+  if (std::max(kind(a), kind(b)) == Float) {
+    return from(std::fmod(to_double(a), to_double(b)));
+  }
+  if (is_zero(b)) {
+    throw std::runtime_error("Division by zero");
+  }
+  Value remainder;
+  divmod(a, b, nullptr, &remainder);
+  return remainder;
+}
+
+Value sqrt(const Value &a) {
+  switch (kind(a)) {
+  case Small:
+  case Wide: {
+    auto n = to_int64(a);
+    if (n < 0) {
+      break;
+    }
+    // The float root is within one of the integer root
+    auto root = (std::uint64_t)std::sqrt((double)n);
+    while (root * root > (std::uint64_t)n) {
+      --root;
+    }
+    while ((root + 1) * (root + 1) <= (std::uint64_t)n) {
+      ++root;
+    }
+    if (root * root == (std::uint64_t)n) {
+      return from((std::int64_t)root);
+    }
+    break;
+  }
+  case Big: {
+    const auto &n = a.as<BigInt>();
+    if (n.negative()) {
+      break;
+    }
+    auto root = isqrt(n);
+    if (compare(root * root, n) == 0) {
+      return from(std::move(root));
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return from(std::sqrt(to_double(a)));
+}
+
+bool equal(const Value &a, const Value &b) {
+  if (is_small(a) && is_small(b)) {
+    return a.as<int>() == b.as<int>();
+  }
+  auto ka = kind(a);
+  auto kb = kind(b);
+  if (ka == Float || kb == Float) {
+    return to_double(a) == to_double(b);
+  }
+  // Integers are always as narrow as they can be, so equal ones are the same
+  // kind
+  if (ka != kb) {
+    return false;
+  }
+  if (ka == Wide) {
+    return to_int64(a) == to_int64(b);
+  }
+  return compare(a.as<BigInt>(), b.as<BigInt>()) == 0;
+}
+
+bool less(const Value &a, const Value &b) {
+  if (is_small(a) && is_small(b)) {
+    return a.as<int>() < b.as<int>();
+  }
+  auto kind = std::max(Num::kind(a), Num::kind(b));
+  if (kind == Float) {
+    return to_double(a) < to_double(b);
+  }
+  if (kind == Wide) {
+    return to_int64(a) < to_int64(b);
+  }
+  BigInt xs, ys;
+  return compare(to_big(a, xs), to_big(b, ys)) < 0;
+}
+
+int to_int(const Value &value) {
+  switch (kind(value)) {
+  case Small:
+    return value.as<int>();
+  case Float:
+    throw std::runtime_error("Expected an integer");
+  default:
+    throw std::runtime_error("Integer out of range");
+  }
+}
+
+double to_double(const Value &value) {
+  switch (kind(value)) {
+  case Small:
+  case Wide:
+    return (double)to_int64(value);
+  case Big:
+    return value.as<BigInt>().to_double();
+  default:
+    return value.as<double>();
+  }
+}
+
+void print(std::ostream &out, const Value &value) {
+  switch (kind(value)) {
+  case Small:
+    out << value.as<int>();
+    break;
+  case Wide:
+    out << value.as<Int64>().value;
+    break;
+  case Big:
+    out << value.as<BigInt>().to_string();
+    break;
+  case Float: {
+    // The shortest digits that give back the same double, with a point
+    // added where needed so that it does not look like an integer
+    char buf[64];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value.as<double>());
+    std::string_view digits(buf, end - buf);
+    out << digits;
+    if (digits.find_first_of(".ein") == std::string_view::npos) {
+      out << ".0";
+    }
+    break;
+  }
+  }
+}
+
+std::string to_string(const Value &value) {
+  std::ostringstream out;
+  print(out, value);
+  return out.str();
+}
+
+} // namespace Num
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "bigint.hpp"
+#include "value.hpp"
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Integers that overflow an immediate int but still fit in 64 bits
+struct Int64 {
+  std::int64_t value;
+};
+
+// Arithmetic on the numeric tower. A number Value is one of, from narrowest
+// to widest:
+//
+//   - an immediate int, which is what almost every number is
+//   - a boxed Int64
+//   - a boxed BigInt
+//   - a boxed double
+//
+// Integers always use the narrowest representation that holds them, so two
+// equal integers are also represented the same way. Mixing a float into an
+// operation makes the result a float; otherwise integer arithmetic is exact,
+// and results only get boxed when they no longer fit in an int.
+namespace Num {
+
+enum Kind { Small, Wide, Big, Float };
+
+// Throws when value is not a number
+Kind kind(const Value &value);
+inline bool is_small(const Value &value) { return value.tag() == Value::Int; }
+
+Value from(std::int64_t value);
+Value from(BigInt value);
+Value from(double value);
+
+Value add_slow(const Value &a, const Value &b);
+Value sub_slow(const Value &a, const Value &b);
+Value mul_slow(const Value &a, const Value &b);
+
+inline Value add(const Value &a, const Value &b) {
+  int out;
+  if (is_small(a) && is_small(b) &&
+      !__builtin_add_overflow(a.as<int>(), b.as<int>(), &out)) {
+    return out;
+  }
+  return add_slow(a, b);
+}
+
+inline Value sub(const Value &a, const Value &b) {
+  int out;
+  if (is_small(a) && is_small(b) &&
+      !__builtin_sub_overflow(a.as<int>(), b.as<int>(), &out)) {
+    return out;
+  }
+  return sub_slow(a, b);
+}
+
+inline Value mul(const Value &a, const Value &b) {
+  int out;
+  if (is_small(a) && is_small(b) &&
+      !__builtin_mul_overflow(a.as<int>(), b.as<int>(), &out)) {
+    return out;
+  }
+  return mul_slow(a, b);
+}
+
+Value neg(const Value &a);
+// Integer division truncates towards zero, and the remainder takes the sign
+// of the dividend. Dividing an integer by zero throws.
+Value div(const Value &a, const Value &b);
+Value rem(const Value &a, const Value &b);
+// Exact for perfect squares, a float otherwise
+Value sqrt(const Value &a);
+
+bool equal(const Value &a, const Value &b);
+bool less(const Value &a, const Value &b);
+
+// For arguments that count or index things, which have to be small integers
+int to_int(const Value &value);
+double to_double(const Value &value);
+
+void print(std::ostream &out, const Value &value);
+std::string to_string(const Value &value);
+
+} // namespace Num
@@ -1,9 +1,13 @@
 #include "parser.hpp"
+#include "bigint.hpp"
+#include "number.hpp"
+#include "symbol.hpp"
 
 #include <algorithm>
-#include <cctype>
 #include <charconv>
-#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
 #include <vector>
 
 bool is_paren(char c) { return c == '(' || c == ')'; }
@@ -14,20 +18,31 @@ bool is_op(char c) {
 }
 
 bool is_whitespace(char c) {
-  return c == '\n' || c == ' ' || c == '\t' || c == '\0';
+  return c == '\n' || c == ' ' || c == '\t' || c == '\r' || c == '\0';
 }
 
 bool is_bracket(char c) { return c == '[' || c == ']'; }
 
 bool is_quote(char c) { return c == '\''; }
 
+bool is_comment(char c) { return c == ';'; }
+
 bool is_special(char c) {
   return is_paren(c) || is_op(c) || is_whitespace(c) || is_bracket(c) ||
-         is_quote(c);
+         is_quote(c) || is_comment(c);
+}
+
+bool is_number(std::string_view str) {
+  return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) {
+           return c >= '0' && c <= '9';
+         });
 }
 
-bool is_number(const std::string &str) {
-  return !str.empty() && std::all_of(str.begin(), str.end(), ::isdigit);
+// Digits on both sides of the point
+bool is_float(std::string_view str) {
+  auto point = str.find('.');
+  return point != std::string_view::npos && is_number(str.substr(0, point)) &&
+         is_number(str.substr(point + 1));
 }
 
 std::string keyword_str(Keyword kw) {
@@ -38,92 +53,174 @@ std::string keyword_str(Keyword kw) {
     return "DEFN";
   case Keyword::If:
     return "IF";
+  case Keyword::DefnMemo:
+    return "DEFN_MEMO";
+  case Keyword::Profile:
+    return "PROFILE";
   }
   return "???";
 }
 
-std::vector<Token> parse(const std::string &source) {
-  std::vector<Token> tokens;
-  const char *cstr = source.c_str();
+void Lexer::word(std::string_view text, std::size_t offset,
+                 std::vector<Token> &tokens) {
+  Token tok;
+  if (text == "def") {
+    tok = {Token::Keyword, Keyword::Def};
+  } else if (text == "defn") {
+    tok = {Token::Keyword, Keyword::Defn};
+  } else if (text == "defn_memo") {
+    tok = {Token::Keyword, Keyword::DefnMemo};
+  } else if (text == "if") {
+    tok = {Token::Keyword, Keyword::If};
+  } else if (text == "profile") {
+    tok = {Token::Keyword, Keyword::Profile};
+  } else if (text == "true") {
+    tok = {Token::Bool, true};
+  } else if (text == "false") {
+    tok = {Token::Bool, false};
+  } else if (is_number(text)) {
+    // Too many digits for 64 bits is still a number, just a big one
+    std::int64_t number;
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), number);
+    if (ec == std::errc()) {
+      tok = {Token::Number, Num::from(number)};
+    } else {
+      tok = {Token::Number, Num::from(*BigInt::parse(text))};
+    }
+  } else if (is_float(text)) {
+    double number;
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), number);
+    if (ec != std::errc()) {
+      throw SyntaxError("Number literal out of range", offset);
+    }
+    tok = {Token::Number, Num::from(number)};
+  } else {
+    tok = {Token::Identifier, intern(text)};
+  }
 
+  tok.offset = offset;
+  tok.length = text.size();
+  tokens.push_back(std::move(tok));
+}
+
+void Lexer::feed(std::string_view chunk, std::vector<Token> &tokens) {
   std::size_t i = 0;
-  char buf[1024];
-  std::memset(buf, 0, 1024);
-  std::size_t bufi = 0;
 
-  while (true) {
-    while (!is_special(cstr[i])) {
-      buf[bufi++] = cstr[i++];
+  // Finish off a word the previous chunk ended in the middle of
+  if (!m_pending.empty()) {
+    while (i < chunk.size() && !is_special(chunk[i])) {
+      i++;
+    }
+    m_pending.append(chunk.substr(0, i));
+    if (i == chunk.size()) {
+      m_offset += chunk.size();
+      return;
     }
+    word(m_pending, m_pending_offset, tokens);
+    m_pending.clear();
+  }
 
-    if (bufi == 0) {
-      if (is_whitespace(cstr[i])) {
-        if (cstr[i] == '\0') {
-          break;
-        }
-        i++;
-        continue;
-      }
+  while (i < chunk.size()) {
+    char c = chunk[i];
+    auto offset = m_offset + i;
 
-      if (cstr[i] == '\0') {
-        break;
-      }
+    // Comments run to the end of the line
+    if (m_in_comment) {
+      m_in_comment = c != '\n';
+      i++;
+      continue;
+    }
 
-      if (is_paren(cstr[i])) {
-        tokens.push_back({Token::Paren, cstr[i]});
-        i++;
-        continue;
-      }
+    if (is_comment(c)) {
+      m_in_comment = true;
+      i++;
+      continue;
+    }
 
-      if (is_op(cstr[i])) {
-        tokens.push_back({Token::Operator, cstr[i]});
-        i++;
-        continue;
-      }
+    if (is_whitespace(c)) {
+      i++;
+      continue;
+    }
 
-      if (is_bracket(cstr[i])) {
-        tokens.push_back({Token::Bracket, cstr[i]});
+    if (is_paren(c)) {
+      tokens.push_back({Token::Paren, c, offset, 1});
+    } else if (is_op(c)) {
+      tokens.push_back({Token::Operator, c, offset, 1});
+    } else if (is_bracket(c)) {
+      tokens.push_back({Token::Bracket, c, offset, 1});
+    } else if (is_quote(c)) {
+      tokens.push_back({Token::Quote, c, offset, 1});
+    } else {
+      auto start = i;
+      while (i < chunk.size() && !is_special(chunk[i])) {
         i++;
-        continue;
       }
 
-      if (is_quote(cstr[i])) {
-        tokens.push_back({Token::Quote, cstr[i]});
-        i++;
-        continue;
+      // The word may carry on in the next chunk
+      if (i == chunk.size()) {
+        m_pending.assign(chunk.substr(start));
+        m_pending_offset = offset;
+        break;
       }
-    }
 
-    if (bufi != 0) {
-      buf[bufi] = '\0';
+      word(chunk.substr(start, i - start), offset, tokens);
+      continue;
     }
 
-    std::string str = bufi == 0 ? &cstr[i] : buf;
-
-    if (str == "def") {
-      tokens.push_back({Token::Keyword, Keyword::Def});
-    } else if (str == "defn") {
-      tokens.push_back({Token::Keyword, Keyword::Defn});
-    } else if (str == "if") {
-      tokens.push_back({Token::Keyword, Keyword::If});
-    } else if (str == "true") {
-      tokens.push_back({Token::Bool, true});
-    } else if (str == "false") {
-      tokens.push_back({Token::Bool, false});
-    } else if (is_number(str)) {
-      int number;
-      std::from_chars(str.data(), str.data() + str.size(), number);
-      tokens.push_back({Token::Number, number});
-    } else {
-      tokens.push_back({Token::Identifier, str});
+    i++;
+  }
+
+  m_offset += chunk.size();
+}
+
+void Lexer::finish(std::vector<Token> &tokens) {
+  if (!m_pending.empty()) {
+    word(m_pending, m_pending_offset, tokens);
+    m_pending.clear();
+  }
+  m_in_comment = false;
+}
+
+std::vector<std::vector<Token>> split_forms(std::vector<Token> tokens) {
+  std::vector<std::vector<Token>> forms;
+  std::vector<Token> form;
+  std::size_t depth = 0;
+
+  for (auto &tok : tokens) {
+    bool quote = tok.type == Token::Quote;
+    if (tok.type == Token::Paren || tok.type == Token::Bracket) {
+      char c = tok.as<char>();
+      if (c == '(' || c == '[') {
+        depth++;
+      } else if (depth == 0) {
+        throw SyntaxError(std::string("Unexpected '") + c + "'", tok.offset);
+      } else {
+        depth--;
+      }
     }
 
-    if (cstr[i] == '\0') {
-      break;
+    form.push_back(std::move(tok));
+
+    // A quote belongs to whatever follows it
+    if (depth == 0 && !quote) {
+      forms.push_back(std::move(form));
+      form.clear();
     }
+  }
 
-    bufi = 0;
+  if (!form.empty()) {
+    throw SyntaxError("Unterminated expression", form.front().offset);
   }
 
+  return forms;
+}
+
+std::vector<Token> parse(std::string_view source) {
+  std::vector<Token> tokens;
+  Lexer lexer;
+  lexer.feed(source, tokens);
+  lexer.finish(tokens);
   return tokens;
 }
@@ -1,11 +1,14 @@
 #pragma once
 
-#include <any>
+#include "value.hpp"
+
+#include <cstddef>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum Keyword { Def, Defn, If };
+enum Keyword { Def, Defn, If, DefnMemo, Profile };
 
 std::string keyword_str(Keyword kw);
 
@@ -20,11 +23,12 @@ struct Token {
     Keyword,
     Identifier
   } type;
-  std::any value;
-
-  template <typename T> T as() { return std::any_cast<T>(value); }
+  Value value;
+  // Where the token came from in the source, in bytes
+  std::size_t offset = 0;
+  std::size_t length = 0;
 
-  template <typename T> T as() const { return std::any_cast<T>(value); }
+  template <typename T> decltype(auto) as() const { return value.as<T>(); }
 
   Token get_if(Type _type) {
     if (_type != type) {
@@ -34,4 +38,34 @@ struct Token {
   }
 };
 
-std::vector<Token> parse(const std::string &source);
+// A program that cannot be compiled, and where in the source the token that
+// gave it away starts
+struct SyntaxError : std::runtime_error {
+  std::size_t offset;
+
+  SyntaxError(const std::string &message, std::size_t _offset)
+      : std::runtime_error(message), offset(_offset) {}
+};
+
+// Tokenizes source that may arrive in pieces. Tokens never copy the source:
+// identifiers are interned straight from it, and only a word that is split
+// across two chunks is held back until the rest of it arrives.
+class Lexer {
+private:
+  std::string m_pending;
+  std::size_t m_pending_offset = 0;
+  std::size_t m_offset = 0;
+  bool m_in_comment = false;
+
+  void word(std::string_view text, std::size_t offset,
+            std::vector<Token> &tokens);
+
+public:
+  void feed(std::string_view chunk, std::vector<Token> &tokens);
+  void finish(std::vector<Token> &tokens);
+};
+
+std::vector<Token> parse(std::string_view source);
+
+// Groups tokens into top-level forms, which may span any number of lines
+std::vector<std::vector<Token>> split_forms(std::vector<Token> tokens);
@@ -0,0 +1,188 @@
+#include "pool.hpp"
+#include "value.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+
+namespace {
+
+thread_local bool t_in_worker = false;
+
+std::size_t default_workers() {
+  if (const char *env = std::getenv("LISPY_THREADS")) {
+    auto n = std::strtoul(env, nullptr, 10);
+    if (n > 0) {
+      return n;
+    }
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+constexpr auto NoError = std::numeric_limits<std::size_t>::max();
+
+} // namespace
+
+WorkPool &WorkPool::instance() {
+  static WorkPool s_pool(default_workers());
+  return s_pool;
+}
+
+WorkPool::WorkPool(std::size_t workers) {
+  for (std::size_t i = 0; i < workers; i++) {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+  for (std::size_t i = 1; i < workers; i++) {
+    m_threads.emplace_back(&WorkPool::thread_main, this, i);
+  }
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard guard(m_lock);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+bool WorkPool::in_worker() { return t_in_worker; }
+
+bool WorkPool::run(std::size_t count, std::size_t grain, const Body &body) {
+  if (t_in_worker || !m_busy.try_lock()) {
+    return false;
+  }
+  std::lock_guard busy(m_busy, std::adopt_lock);
+
+  m_error = nullptr;
+  m_error_at = NoError;
+  m_remaining = count;
+  // Already set for as long as --serve runs its own threads
+  bool shared = g_shared_heap;
+  if (!shared) {
+    g_shared_heap = true;
+  }
+
+  {
+    std::lock_guard guard(m_lock);
+    m_body = &body;
+    m_grain = std::max<std::size_t>(grain, 1);
+
+    auto slice = (count + workers() - 1) / workers();
+    for (std::size_t i = 0; i < workers(); i++) {
+      auto begin = std::min(count, i * slice);
+      auto end = std::min(count, begin + slice);
+      if (begin < end) {
+        push(i, {begin, end});
+      }
+    }
+    ++m_generation;
+  }
+  m_wake.notify_all();
+
+  t_in_worker = true;
+  work(0);
+  t_in_worker = false;
+
+  {
+    std::unique_lock guard(m_lock);
+    m_done.wait(guard, [&] { return m_active == 0; });
+    m_body = nullptr;
+  }
+  if (!shared) {
+    g_shared_heap = false;
+  }
+
+  if (m_error) {
+    std::rethrow_exception(std::exchange(m_error, nullptr));
+  }
+  return true;
+}
+
+void WorkPool::thread_main(std::size_t worker) {
+  t_in_worker = true;
+  std::uint64_t seen = 0;
+
+  while (true) {
+    {
+      std::unique_lock guard(m_lock);
+      m_wake.wait(guard, [&] { return m_stop || m_generation != seen; });
+      if (m_stop) {
+        return;
+      }
+      seen = m_generation;
+      ++m_active;
+    }
+
+    work(worker);
+
+    {
+      std::lock_guard guard(m_lock);
+      --m_active;
+    }
+    m_done.notify_all();
+  }
+}
+
+void WorkPool::work(std::size_t worker) {
+  Range range;
+  while (m_remaining.load(std::memory_order_acquire) > 0) {
+    if (!take(worker, range)) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    while (range.end - range.begin > m_grain) {
+      auto mid = range.begin + (range.end - range.begin) / 2;
+      push(worker, {mid, range.end});
+      range.end = mid;
+    }
+
+    if (range.begin < m_error_at.load(std::memory_order_relaxed)) {
+      try {
+        (*m_body)(worker, range.begin, range.end);
+      } catch (...) {
+        std::lock_guard guard(m_error_lock);
+        if (range.begin < m_error_at) {
+          m_error = std::current_exception();
+          m_error_at = range.begin;
+        }
+      }
+    }
+
+    m_remaining.fetch_sub(range.end - range.begin, std::memory_order_acq_rel);
+  }
+}
+
+// Newest range from our own deque first, oldest from anyone else's after
+bool WorkPool::take(std::size_t worker, Range &range) {
+  {
+    auto &own = *m_queues[worker];
+    std::lock_guard guard(own.lock);
+    if (!own.ranges.empty()) {
+      range = own.ranges.back();
+      own.ranges.pop_back();
+      return true;
+    }
+  }
+
+  for (std::size_t i = 1; i < workers(); i++) {
+    auto &other = *m_queues[(worker + i) % workers()];
+    std::lock_guard guard(other.lock);
+    if (!other.ranges.empty()) {
+      range = other.ranges.front();
+      other.ranges.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkPool::push(std::size_t worker, Range range) {
+  auto &own = *m_queues[worker];
+  std::lock_guard guard(own.lock);
+  own.ranges.push_back(range);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for the data-parallel builtins. Work is handed
+// out as index ranges, one slice per worker to begin with. A worker halves
+// whatever it takes until it is down to the grain size, keeping the halves on
+// its own deque, and idle workers steal from the far end of everyone else's.
+//
+// The pool size comes from LISPY_THREADS, or the number of cores.
+class WorkPool {
+public:
+  using Body = std::function<void(std::size_t worker, std::size_t begin,
+                                  std::size_t end)>;
+
+  static WorkPool &instance();
+
+  WorkPool(const WorkPool &) = delete;
+  WorkPool &operator=(const WorkPool &) = delete;
+  ~WorkPool();
+
+  // Including the calling thread, which always takes part as worker 0
+  std::size_t workers() const { return m_queues.size(); }
+
+  // True on a thread that is currently running pool work, where starting
+  // another parallel job would only deadlock
+  static bool in_worker();
+
+  // Runs body over [0, count) and waits for all of it. Returns false without
+  // running anything when another job is in progress, so that the caller can
+  // do the work itself. When body throws, the ranges after it are skipped and
+  // the exception from the lowest index is rethrown, the same one a serial
+  // loop would have stopped at.
+  bool run(std::size_t count, std::size_t grain, const Body &body);
+
+private:
+  struct Range {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  struct Queue {
+    std::mutex lock;
+    std::deque<Range> ranges;
+  };
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+
+  // Guards the job hand-off between run() and the threads
+  std::mutex m_lock;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  std::uint64_t m_generation = 0;
+  std::size_t m_active = 0;
+  bool m_stop = false;
+
+  // Only one job runs at a time
+  std::mutex m_busy;
+  const Body *m_body = nullptr;
+  std::size_t m_grain = 1;
+  std::atomic<std::size_t> m_remaining{0};
+
+  std::mutex m_error_lock;
+  std::exception_ptr m_error;
+  std::atomic<std::size_t> m_error_at{0};
+
+  explicit WorkPool(std::size_t workers);
+
+  void thread_main(std::size_t worker);
+  void work(std::size_t worker);
+  bool take(std::size_t worker, Range &range);
+  void push(std::size_t worker, Range range);
+};
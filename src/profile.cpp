@@ -0,0 +1,124 @@
+#include "profile.hpp"
+#include "core.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+Profiler::Profiler(Profiler *outer) : m_outer(outer) {
+  m_paths.push_back({0, 0});
+  for (std::size_t i = 0; i < builtin_count(); i++) {
+    m_builtin_names.push_back(intern(builtin(i).name));
+  }
+}
+
+std::uint32_t Profiler::entry_for(SymbolId name) {
+  if (name >= m_entry_of.size()) {
+    m_entry_of.resize(name + 1);
+  }
+  if (m_entry_of[name] == 0) {
+    m_entries.push_back({name});
+    m_open.push_back(0);
+    m_entry_of[name] = m_entries.size();
+  }
+  return m_entry_of[name] - 1;
+}
+
+std::uint32_t Profiler::child(std::uint32_t parent, SymbolId name) {
+  auto key = (std::uint64_t)parent << 32 | name;
+  auto [it, added] = m_children.try_emplace(key, m_paths.size());
+  if (added) {
+    m_paths.push_back({name, parent});
+  }
+  return it->second;
+}
+
+void Profiler::enter(SymbolId name) {
+  auto parent = m_frames.empty() ? 0 : m_frames.back().path;
+  auto entry = entry_for(name);
+  ++m_entries[entry].calls;
+  ++m_open[entry];
+  m_frames.push_back({child(parent, name), entry, Clock::now()});
+
+  if (m_outer != nullptr) {
+    m_outer->enter(name);
+  }
+}
+
+void Profiler::enter_builtin(std::size_t index) {
+  enter(m_builtin_names[index]);
+}
+
+void Profiler::leave() {
+  if (m_frames.empty()) {
+    return;
+  }
+  auto frame = m_frames.back();
+  m_frames.pop_back();
+
+  auto elapsed = (std::uint64_t)std::chrono::duration_cast<
+                     std::chrono::nanoseconds>(Clock::now() - frame.start)
+                     .count();
+  auto self = elapsed - std::min(elapsed, frame.child_ns);
+  m_paths[frame.path].self_ns += self;
+
+  auto &entry = m_entries[frame.entry];
+  entry.self_ns += self;
+  if (--m_open[frame.entry] == 0) {
+    entry.total_ns += elapsed;
+  }
+  if (!m_frames.empty()) {
+    m_frames.back().child_ns += elapsed;
+  }
+
+  if (m_outer != nullptr) {
+    m_outer->leave();
+  }
+}
+
+void Profiler::unwind(std::size_t depth) {
+  while (m_frames.size() > depth) {
+    leave();
+  }
+}
+
+std::vector<Profiler::Entry> Profiler::entries() const {
+  auto sorted = m_entries;
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Entry &a, const Entry &b) {
+                     return a.self_ns > b.self_ns;
+                   });
+  return sorted;
+}
+
+void Profiler::print(std::ostream &out) const {
+  char line[128];
+  std::snprintf(line, sizeof(line), "%12s %12s %12s  %s\n", "calls",
+                "self ms", "total ms", "function");
+  out << line;
+  for (const auto &entry : entries()) {
+    std::snprintf(line, sizeof(line), "%12llu %12.3f %12.3f  ",
+                  (unsigned long long)entry.calls, entry.self_ns / 1e6,
+                  entry.total_ns / 1e6);
+    out << line << symbol_name(entry.name) << "\n";
+  }
+}
+
+void Profiler::write_folded(std::ostream &out) const {
+  std::vector<SymbolId> stack;
+  for (std::size_t i = 1; i < m_paths.size(); i++) {
+    auto micros = m_paths[i].self_ns / 1000;
+    if (micros == 0) {
+      continue;
+    }
+
+    stack.clear();
+    for (auto p = (std::uint32_t)i; p != 0; p = m_paths[p].parent) {
+      stack.push_back(m_paths[p].name);
+    }
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+      out << (it == stack.rbegin() ? "" : ";") << symbol_name(*it);
+    }
+    out << " " << micros << "\n";
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "symbol.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Call counts and timings of user functions and builtins, and of the stacks
+// they were called from. The VM and collapse() report the calls they make to
+// the interpreter's profiler while it has one (see --profile and the profile
+// form). Operators are not counted, their time goes to whoever applied them.
+class Profiler {
+public:
+  struct Entry {
+    SymbolId name;
+    std::uint64_t calls = 0;
+    std::uint64_t self_ns = 0;
+    // Of a recursive function, only its outermost calls count here
+    std::uint64_t total_ns = 0;
+  };
+
+  // Calls made while this profiler is active are also reported to outer
+  explicit Profiler(Profiler *outer = nullptr);
+
+  void enter(SymbolId name);
+  void enter_builtin(std::size_t index);
+  void leave();
+
+  std::size_t depth() const { return m_frames.size(); }
+  // Leaves every call above depth, for when an error skipped their returns
+  void unwind(std::size_t depth);
+
+  // Most self time first
+  std::vector<Entry> entries() const;
+  void print(std::ostream &out) const;
+  // One line per call stack, "outer;inner microseconds", as read by
+  // flamegraph.pl and the tools that follow it
+  void write_folded(std::ostream &out) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // A node in the tree of call stacks; path 0 is the root
+  struct Path {
+    SymbolId name;
+    std::uint32_t parent;
+    std::uint64_t self_ns = 0;
+  };
+
+  struct Frame {
+    std::uint32_t path;
+    std::uint32_t entry;
+    Clock::time_point start;
+    std::uint64_t child_ns = 0;
+  };
+
+  Profiler *m_outer;
+  std::vector<Entry> m_entries;
+  // Indexed by symbol id, one more than the entry (0 when there is none)
+  std::vector<std::uint32_t> m_entry_of;
+  // How many calls of each entry are open
+  std::vector<std::uint32_t> m_open;
+  std::vector<Path> m_paths;
+  std::unordered_map<std::uint64_t, std::uint32_t> m_children;
+  std::vector<Frame> m_frames;
+  std::vector<SymbolId> m_builtin_names;
+
+  std::uint32_t entry_for(SymbolId name);
+  std::uint32_t child(std::uint32_t parent, SymbolId name);
+};
+
+// Unwinds a profiler back to where it was when the scope was entered
+class ProfileScope {
+private:
+  Profiler *m_profiler;
+  std::size_t m_depth;
+
+public:
+  explicit ProfileScope(Profiler *profiler)
+      : m_profiler(profiler),
+        m_depth(profiler != nullptr ? profiler->depth() : 0) {}
+  ~ProfileScope() {
+    if (m_profiler != nullptr) {
+      m_profiler->unwind(m_depth);
+    }
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+};
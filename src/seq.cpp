@@ -0,0 +1,275 @@
+#include "seq.hpp"
+#include "kernel.hpp"
+#include "number.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+Seq Seq::range(int first, int last) {
+  Seq seq;
+  seq.first = first;
+  seq.last = last;
+  return seq;
+}
+
+Seq Seq::over(Vector vec) {
+  Seq seq;
+  seq.source = std::move(vec);
+  return seq;
+}
+
+Seq Seq::then(Stage::Kind kind, Node fn) const {
+  auto seq = *this;
+  seq.stages.push_back({kind, std::move(fn)});
+  return seq;
+}
+
+namespace {
+
+// Runs the elements through the kernels a block at a time, in lanes of T
+template <typename T>
+void run_blocks(const Seq &seq, const std::vector<Kernel> &kernels,
+                std::size_t count, const Seq::BlockFn &yield) {
+  T block[Kernel::Block];
+  std::int64_t wide[Kernel::Block];
+  auto it = seq.source ? seq.source->begin()
+                       : Vector::const_iterator(nullptr, 0);
+
+  for (std::size_t done = 0; done < count;) {
+    auto n = std::min(Kernel::Block, count - done);
+    if (seq.source) {
+      for (std::size_t i = 0; i < n; i++, ++it) {
+        block[i] = Num::is_small((*it).value) ? (*it).as<int>()
+                                              : (*it).as<Int64>().value;
+      }
+    } else {
+      auto start = seq.first + (long)done;
+      for (std::size_t i = 0; i < n; i++) {
+        block[i] = (T)(start + (long)i);
+      }
+    }
+    done += n;
+
+    for (std::size_t i = 0; i < kernels.size() && n > 0; i++) {
+      if (seq.stages[i].kind == Seq::Stage::Map) {
+        kernels[i].apply(block, n);
+      } else {
+        n = kernels[i].select(block, n);
+      }
+    }
+    if (n == 0) {
+      continue;
+    }
+    if constexpr (std::is_same_v<T, std::int64_t>) {
+      yield(block, n);
+    } else {
+      std::copy_n(block, n, wide);
+      yield(wide, n);
+    }
+  }
+}
+
+} // namespace
+
+bool Seq::each_block(Interpreter &ctx, const BlockFn &yield,
+                     std::size_t nstages) const {
+  nstages = std::min(nstages, stages.size());
+
+  std::vector<Kernel> kernels;
+  for (std::size_t i = 0; i < nstages; i++) {
+    const auto &stage = stages[i];
+    auto kernel = stage.kind == Stage::Map ? Kernel::map(ctx, stage.fn)
+                                           : Kernel::filter(ctx, stage.fn);
+    if (!kernel) {
+      return false;
+    }
+    kernels.push_back(std::move(*kernel));
+  }
+
+  // The range the elements fall in, which decides whether the kernels can run
+  // in 32-bit lanes, 64-bit ones, or not at all
+  std::size_t count = last >= first ? last - first + 1 : 0;
+  std::int64_t lo = first;
+  std::int64_t hi = last;
+  if (source) {
+    count = source->size();
+    lo = std::numeric_limits<std::int64_t>::max();
+    hi = std::numeric_limits<std::int64_t>::min();
+    for (const auto &node : *source) {
+      if (node.type != Node::Number) {
+        return false;
+      }
+      auto kind = Num::kind(node.value);
+      if (kind != Num::Small && kind != Num::Wide) {
+        return false;
+      }
+      auto value = kind == Num::Small ? node.as<int>() : node.as<Int64>().value;
+      lo = std::min(lo, value);
+      hi = std::max(hi, value);
+    }
+  }
+  if (count == 0) {
+    return true;
+  }
+
+  auto lanes = lo < std::numeric_limits<std::int32_t>::min() ||
+                       hi > std::numeric_limits<std::int32_t>::max()
+                   ? Kernel::Lanes::Wide
+                   : Kernel::Lanes::Narrow;
+  for (std::size_t i = 0; i < nstages; i++) {
+    auto stage_lo = lo;
+    auto stage_hi = hi;
+    auto stage = kernels[i].lanes(stage_lo, stage_hi);
+    if (!stage) {
+      return false;
+    }
+    if (*stage == Kernel::Lanes::Wide) {
+      lanes = Kernel::Lanes::Wide;
+    }
+    // A filter passes on some of its input, not its result
+    if (stages[i].kind == Stage::Map) {
+      lo = stage_lo;
+      hi = stage_hi;
+    }
+  }
+
+  // Without any kernels, narrow lanes would only have to be widened again
+  if (lanes == Kernel::Lanes::Narrow && !kernels.empty()) {
+    run_blocks<std::int32_t>(*this, kernels, count, yield);
+  } else {
+    run_blocks<std::int64_t>(*this, kernels, count, yield);
+  }
+  return true;
+}
+
+std::size_t Seq::size(Interpreter &ctx) const {
+  // Maps after the last filter cannot change how many elements there are
+  std::size_t counted = 0;
+  for (std::size_t i = 0; i < stages.size(); i++) {
+    if (stages[i].kind == Stage::Filter) {
+      counted = i + 1;
+    }
+  }
+
+  if (counted == 0) {
+    if (source) {
+      return source->size();
+    }
+    return last >= first ? last - first + 1 : 0;
+  }
+
+  std::size_t count = 0;
+  auto blocks = each_block(
+      ctx, [&](const std::int64_t *, std::size_t n) { count += n; }, counted);
+  if (!blocks) {
+    each(
+        ctx,
+        [&](const Node &) {
+          ++count;
+          return true;
+        },
+        counted);
+  }
+  return count;
+}
+
+Node Seq::nth(Interpreter &ctx, std::size_t index) const {
+  std::optional<Node> found;
+  each(ctx, [&](Node node) {
+    if (index-- == 0) {
+      found = std::move(node);
+      return false;
+    }
+    return true;
+  });
+  if (!found) {
+    throw std::runtime_error("Vector index out of range");
+  }
+  return std::move(*found);
+}
+
+Node Seq::reduce(Interpreter &ctx, const Node &fn) const {
+  std::optional<Node> value;
+
+  // Sums and products of numbers never need to go through collapse(). They
+  // are kept in 64 bits, and whenever that would overflow, what there is so
+  // far is folded into a promoted value and the 64 bits start over.
+  if (auto kind = fold_kernel(ctx, fn)) {
+    auto combine = [&](const Value &a, const Value &b) {
+      return *kind == Fold::Add ? Num::add(a, b) : Num::mul(a, b);
+    };
+    std::optional<std::int64_t> acc;
+    auto blocks = each_block(ctx, [&](const std::int64_t *values,
+                                      std::size_t n) {
+      if (!acc) {
+        acc = values[0];
+        ++values;
+        --n;
+      }
+      while (n > 0) {
+        auto taken = fold(*kind, *acc, values, n);
+        values += taken;
+        n -= taken;
+        if (n == 0) {
+          break;
+        }
+        auto spilled = Num::from(*acc);
+        value = Node{Node::Number,
+                     value ? combine(value->value, spilled) : spilled};
+        acc = values[0];
+        ++values;
+        --n;
+      }
+    });
+    if (blocks) {
+      if (!acc) {
+        throw std::runtime_error("Vector index out of range");
+      }
+      auto rest = Num::from(*acc);
+      return Node{Node::Number, value ? combine(value->value, rest) : rest};
+    }
+  }
+
+  each(ctx, [&](Node node) {
+    if (!value) {
+      value = std::move(node);
+    } else {
+      Node pair[] = {std::move(*value), std::move(node)};
+      value = collapse(ctx, fn, pair);
+    }
+    return true;
+  });
+  if (!value) {
+    throw std::runtime_error("Vector index out of range");
+  }
+  return std::move(*value);
+}
+
+Vector Seq::realize(Interpreter &ctx) const {
+  if (stages.empty() && source) {
+    return *source;
+  }
+
+  Vector vec;
+  auto blocks =
+      each_block(ctx, [&](const std::int64_t *values, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+          vec.push_back({Node::Number, Num::from(values[i])});
+        }
+      });
+  if (!blocks) {
+    each(ctx, [&](Node node) {
+      vec.push_back(std::move(node));
+      return true;
+    });
+  }
+  return vec;
+}
+
+// Realized up front so that an error part way through prints nothing
+void Seq::print(Interpreter &ctx, std::ostream &out) const {
+  realize(ctx).print(out);
+}
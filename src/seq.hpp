@@ -0,0 +1,90 @@
+#pragma once
+
+#include "interpreter.hpp"
+#include "node.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// A vector that has not been computed yet: a source (the numbers of a range,
+// or an existing vector) followed by map and filter stages. Realizing it runs
+// each element through all of the stages before moving on to the next one, so
+// a chain of lazy builtins never builds the vectors in between.
+struct Seq {
+  struct Stage {
+    enum Kind { Map, Filter } kind;
+    Node fn;
+  };
+
+  long first = 0;
+  long last = -1;
+  std::optional<Vector> source;
+  std::vector<Stage> stages;
+
+  static Seq range(int first, int last);
+  static Seq over(Vector vec);
+  Seq then(Stage::Kind kind, Node fn) const;
+
+  // Calls yield with every element that makes it through the first nstages
+  // stages, until yield returns false
+  template <typename F>
+  void each(Interpreter &ctx, F &&yield,
+            std::size_t nstages = std::numeric_limits<std::size_t>::max()) const;
+
+  // Like each(), but hands over blocks of unboxed numbers that went through
+  // kernels compiled from the stages (see kernel.hpp). Returns false, before
+  // calling yield, when a stage cannot be compiled or could overflow 64 bits,
+  // or an element is not an integer that fits in them.
+  using BlockFn = std::function<void(const std::int64_t *, std::size_t)>;
+  bool each_block(
+      Interpreter &ctx, const BlockFn &yield,
+      std::size_t nstages = std::numeric_limits<std::size_t>::max()) const;
+
+  std::size_t size(Interpreter &ctx) const;
+  Node nth(Interpreter &ctx, std::size_t index) const;
+  Node reduce(Interpreter &ctx, const Node &fn) const;
+  Vector realize(Interpreter &ctx) const;
+  void print(Interpreter &ctx, std::ostream &out) const;
+};
+
+template <typename F>
+void Seq::each(Interpreter &ctx, F &&yield, std::size_t nstages) const {
+  nstages = std::min(nstages, stages.size());
+
+  auto emit = [&](Node node) {
+    for (std::size_t i = 0; i < nstages; i++) {
+      const auto &stage = stages[i];
+      if (stage.kind == Stage::Map) {
+        Node arg[] = {std::move(node)};
+        node = collapse(ctx, stage.fn, arg);
+        continue;
+      }
+      Node arg[] = {node};
+      if (!collapse(ctx, stage.fn, arg).get_if(Node::Bool).as<bool>()) {
+        return true;
+      }
+    }
+    return yield(std::move(node));
+  };
+
+  if (source) {
+    for (const auto &node : *source) {
+      if (!emit(node)) {
+        return;
+      }
+    }
+    return;
+  }
+
+  for (auto i = first; i <= last; i++) {
+    if (!emit(Node{Node::Number, (int)i})) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,310 @@
+#include "server.hpp"
+#include "interpreter.hpp"
+#include "source.hpp"
+#include "symbol.hpp"
+#include "value.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LISPY_SERVE
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef LISPY_SERVE
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Requests bigger than this are turned away rather than read into memory
+constexpr std::size_t MaxRequest = 16 * 1024 * 1024;
+
+// A client that sends nothing for this many seconds gives up its worker
+constexpr int ReadTimeout = 30;
+
+volatile std::sig_atomic_t s_stop = 0;
+
+void on_signal(int) { s_stop = 1; }
+
+struct Connection {
+  int fd;
+  std::uint64_t id;
+  Clock::time_point accepted;
+};
+
+// Accepted connections waiting for a worker
+class Queue {
+private:
+  std::mutex m_lock;
+  std::condition_variable m_ready;
+  std::deque<Connection> m_waiting;
+  bool m_closed = false;
+
+public:
+  void push(Connection conn) {
+    {
+      std::lock_guard guard(m_lock);
+      m_waiting.push_back(conn);
+    }
+    m_ready.notify_one();
+  }
+
+  // Waits for a connection, or returns false once the queue is closed and
+  // everything in it has been taken
+  bool pop(Connection &conn) {
+    std::unique_lock guard(m_lock);
+    m_ready.wait(guard, [&] { return m_closed || !m_waiting.empty(); });
+    if (m_waiting.empty()) {
+      return false;
+    }
+    conn = m_waiting.front();
+    m_waiting.pop_front();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard guard(m_lock);
+      m_closed = true;
+    }
+    m_ready.notify_all();
+  }
+};
+
+// Logs every request as it finishes, and keeps its latency for the summary
+class Log {
+private:
+  std::mutex m_lock;
+  std::vector<double> m_ms;
+
+public:
+  void request(std::uint64_t id, std::size_t worker, double ms, bool ok) {
+    char line[96];
+    std::snprintf(line, sizeof(line), "request %llu: worker %zu, %.3f ms%s\n",
+                  (unsigned long long)id, worker, ms, ok ? "" : ", error");
+    std::lock_guard guard(m_lock);
+    m_ms.push_back(ms);
+    std::cerr << line << std::flush;
+  }
+
+  void summary(std::ostream &out) {
+    std::lock_guard guard(m_lock);
+    if (m_ms.empty()) {
+      out << "no requests" << std::endl;
+      return;
+    }
+    std::sort(m_ms.begin(), m_ms.end());
+    auto at = [&](double p) {
+      return m_ms[std::min(m_ms.size() - 1, (std::size_t)(p * m_ms.size()))];
+    };
+    char line[128];
+    std::snprintf(line, sizeof(line),
+                  "%zu requests: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+                  m_ms.size(), at(0.5), at(0.99), m_ms.back());
+    out << line << std::flush;
+  }
+};
+
+// Everything the client sends until it shuts down its end
+bool read_request(int fd, std::string &request) {
+  char buffer[64 * 1024];
+  while (true) {
+    auto n = read(fd, buffer, sizeof(buffer));
+    if (n == 0) {
+      return true;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (request.size() + n > MaxRequest) {
+      return false;
+    }
+    request.append(buffer, n);
+  }
+}
+
+void write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The client hung up, there is no one left to tell
+      return;
+    }
+    data.remove_prefix(n);
+  }
+}
+
+void handle(const Interpreter &prelude, const Connection &conn,
+            std::size_t worker, Log &log) {
+  timeval timeout{ReadTimeout, 0};
+  setsockopt(conn.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  std::ostringstream response;
+  bool ok = false;
+  if (read_request(conn.fd, request)) {
+    // Opened before the fork so that everything naming the request's own
+    // symbols is gone before they are
+    SymbolScope symbols;
+    auto ctx = prelude.fork();
+    ok = run_source(ctx, "<request>", request, &response, response);
+  } else {
+    response << "<request>: could not be read, or is larger than "
+             << MaxRequest << " bytes" << std::endl;
+  }
+  write_all(conn.fd, response.view());
+  close(conn.fd);
+
+  std::chrono::duration<double, std::milli> elapsed =
+      Clock::now() - conn.accepted;
+  log.request(conn.id, worker, elapsed.count(), ok);
+}
+
+// Binds a listening socket to path, replacing a socket that an earlier
+// server left behind but nothing else
+int listen_on(const std::string &path) {
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << path << ": socket path is too long" << std::endl;
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (const sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    std::cerr << path << ": " << std::strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  // Only ever accepted from once select() says there is a connection, which
+  // the client may have dropped again by then
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+} // namespace
+
+int serve(const Interpreter &prelude, const std::string &path,
+          std::size_t workers) {
+  int listener = listen_on(path);
+  if (listener < 0) {
+    return 1;
+  }
+
+  // The signals that stop the server are blocked everywhere but in the
+  // select() below, so that none can arrive between checking s_stop and
+  // waiting. The workers inherit the mask, and a client that hangs up early
+  // must not take the whole server down with SIGPIPE.
+  sigset_t stop_signals;
+  sigset_t waiting;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &waiting);
+  sigdelset(&waiting, SIGINT);
+  sigdelset(&waiting, SIGTERM);
+
+  struct sigaction action{};
+  action.sa_handler = on_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // The workers share the prelude's functions, and so their reference counts
+  g_shared_heap = true;
+
+  Queue queue;
+  Log log;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < workers; i++) {
+    threads.emplace_back([&, i] {
+      Connection conn;
+      while (queue.pop(conn)) {
+        handle(prelude, conn, i, log);
+      }
+    });
+  }
+  std::cerr << "serving " << path << " with " << workers << " workers"
+            << std::endl;
+
+  std::uint64_t next_id = 1;
+  while (!s_stop) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listener, &readable);
+    if (pselect(listener + 1, &readable, nullptr, nullptr, nullptr,
+                &waiting) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << path << ": " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    // Some systems pass the listener's O_NONBLOCK on
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    queue.push({fd, next_id++, Clock::now()});
+  }
+
+  // Whatever was already accepted is still answered
+  close(listener);
+  unlink(path.c_str());
+  queue.close();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  g_shared_heap = false;
+
+  log.summary(std::cerr);
+  return 0;
+}
+
+#else
+
+int serve(const Interpreter &, const std::string &, std::size_t) {
+  std::cerr << "--serve needs Unix domain sockets" << std::endl;
+  return 1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class Interpreter;
+
+// Evaluates programs sent to the Unix domain socket at path, until SIGINT or
+// SIGTERM. Each connection is one request: the client writes a program, shuts
+// down its end for writing, and reads back what -p would have printed for it,
+// or the error it stopped at.
+//
+// Requests are queued for a fixed set of worker threads. A worker runs each
+// request on a fresh fork of prelude, so every request sees the globals that
+// the prelude defined, functions already compiled, and nothing that another
+// request defined. Each request's latency, from being accepted to its response
+// being written, is logged to standard error, and their percentiles when the
+// server stops.
+//
+// Returns the exit status for main().
+int serve(const Interpreter &prelude, const std::string &path,
+          std::size_t workers);
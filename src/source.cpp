@@ -0,0 +1,90 @@
+#include "source.hpp"
+#include "expr.hpp"
+#include "interpreter.hpp"
+#include "parser.hpp"
+
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LISPY_HAVE_MMAP
+#endif
+
+SourceFile::SourceFile(const std::string &path) {
+#ifdef LISPY_HAVE_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      m_map = static_cast<const char *>(map);
+      m_size = st.st_size;
+      close(fd);
+      return;
+    }
+  }
+  close(fd);
+#endif
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  m_buffer.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+}
+
+SourceFile::~SourceFile() {
+#ifdef LISPY_HAVE_MMAP
+  if (m_map != nullptr) {
+    munmap(const_cast<char *>(m_map), m_size);
+  }
+#endif
+}
+
+bool run_source(Interpreter &interpreter, const std::string &name,
+                std::string_view source, std::ostream *out,
+                std::ostream &err) {
+  auto map = std::make_shared<const SourceMap>(name, source);
+  std::size_t offset = 0;
+  try {
+    for (auto &form : split_forms(parse(source))) {
+      offset = form.front().offset;
+      auto program = interpreter.compile(std::move(form), map);
+      auto ret = interpreter.run(program);
+      if (out != nullptr) {
+        ret.print(interpreter, *out);
+      }
+    }
+  } catch (const std::exception &e) {
+    // An error raised at run time can be in code from another source, like
+    // the body of a function that one defined
+    const SourceMap *where = map.get();
+    if (const auto *syntax = dynamic_cast<const SyntaxError *>(&e)) {
+      offset = syntax->offset;
+    } else if (const auto *eval = dynamic_cast<const EvalError *>(&e);
+               eval != nullptr && eval->source != nullptr) {
+      where = eval->source.get();
+      offset = eval->span.offset;
+    }
+    auto [line, column] = where->position(offset);
+    err << where->name() << ":" << line << ":" << column << ": " << e.what()
+        << std::endl;
+    interpreter.reset();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+class Interpreter;
+
+// Read-only view of a whole source file. Regular files are memory-mapped so
+// that the lexer can run straight over the page cache; anything that cannot
+// be mapped (pipes, empty files, other platforms) is read into memory.
+class SourceFile {
+private:
+  const char *m_map = nullptr;
+  std::size_t m_size = 0;
+  std::string m_buffer;
+
+public:
+  explicit SourceFile(const std::string &path);
+  ~SourceFile();
+
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+
+  std::string_view view() const {
+    return m_map != nullptr ? std::string_view{m_map, m_size}
+                            : std::string_view{m_buffer};
+  }
+};
+
+// Evaluates every top-level form in source, printing each result to out when
+// it is given. Stops at the first error, which is reported to err as
+// "name:line:column: message" at the innermost expression it was raised in,
+// which is in the source of whatever function that expression belongs to.
+bool run_source(Interpreter &interpreter, const std::string &name,
+                std::string_view source, std::ostream *out,
+                std::ostream &err);
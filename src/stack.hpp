@@ -1,6 +1,8 @@
 #pragma once
 
+#include <span>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 template <typename T> class Stack {
@@ -11,10 +13,14 @@ public:
   Stack();
   ~Stack();
 
-  void push(const T &data);
+  void push(T data);
   T pop();
   const T &peek() const;
   T &peek();
+  // The top count items, bottom first
+  std::span<T> top(std::size_t count);
+  // Pops the top count items
+  void drop(std::size_t count);
   std::size_t size();
 
   bool is_empty() const { return size() == 0; }
@@ -25,15 +31,15 @@ template <typename T> Stack<T>::Stack() {}
 
 template <typename T> Stack<T>::~Stack() {}
 
-template <typename T> void Stack<T>::push(const T &data) {
-  m_data.push_back(data);
+template <typename T> void Stack<T>::push(T data) {
+  m_data.push_back(std::move(data));
 }
 
 template <typename T> T Stack<T>::pop() {
   if (this->size() == 0) {
     throw std::runtime_error("Popping empty stack");
   }
-  T val = m_data[m_data.size() - 1];
+  T val = std::move(m_data[m_data.size() - 1]);
   m_data.pop_back();
   return val;
 }
@@ -47,4 +53,18 @@ template <typename T> T &Stack<T>::peek() {
   return m_data[m_data.size() - 1];
 }
 
+template <typename T> std::span<T> Stack<T>::top(std::size_t count) {
+  if (count > m_data.size()) {
+    throw std::runtime_error("Peeking empty stack");
+  }
+  return {m_data.data() + m_data.size() - count, count};
+}
+
+template <typename T> void Stack<T>::drop(std::size_t count) {
+  if (count > m_data.size()) {
+    throw std::runtime_error("Popping empty stack");
+  }
+  m_data.resize(m_data.size() - count);
+}
+
 template <typename T> std::size_t Stack<T>::size() { return m_data.size(); }
@@ -0,0 +1,111 @@
+#include "symbol.hpp"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct NameHash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view name) const {
+    return std::hash<std::string_view>{}(name);
+  }
+};
+
+// A deque so that references handed out by symbol_name() stay valid
+std::deque<std::string> s_names;
+std::unordered_map<std::string, SymbolId, NameHash, std::equal_to<>> s_ids;
+
+// The --serve workers parse requests at the same time, and each request can
+// introduce new names
+std::shared_mutex s_lock;
+
+// Names interned while a SymbolScope is open, on top of the table
+struct Scoped {
+  SymbolId base;
+  std::deque<std::string> names;
+  std::unordered_map<std::string, SymbolId, NameHash, std::equal_to<>> ids;
+};
+
+thread_local std::unique_ptr<Scoped> t_scoped;
+// Only changed with s_lock held exclusively
+std::size_t s_open_scopes = 0;
+
+} // namespace
+
+SymbolScope::SymbolScope() {
+  if (t_scoped != nullptr) {
+    throw std::runtime_error("Symbol scopes cannot be nested");
+  }
+  std::unique_lock guard(s_lock);
+  t_scoped.reset(new Scoped{(SymbolId)s_names.size(), {}, {}});
+  ++s_open_scopes;
+}
+
+SymbolScope::~SymbolScope() {
+  std::unique_lock guard(s_lock);
+  --s_open_scopes;
+  t_scoped.reset();
+}
+
+SymbolId intern(std::string_view name) {
+  {
+    std::shared_lock guard(s_lock);
+    auto it = s_ids.find(name);
+    if (it != s_ids.end()) {
+      return it->second;
+    }
+  }
+  if (t_scoped != nullptr) {
+    auto &scoped = *t_scoped;
+    auto it = scoped.ids.find(name);
+    if (it != scoped.ids.end()) {
+      return it->second;
+    }
+    auto id = scoped.base + (SymbolId)scoped.names.size();
+    scoped.names.emplace_back(name);
+    scoped.ids.emplace(scoped.names.back(), id);
+    return id;
+  }
+
+  std::unique_lock guard(s_lock);
+  auto it = s_ids.find(name);
+  if (it != s_ids.end()) {
+    return it->second;
+  }
+  // The ids of every open scope start where the table ends
+  if (s_open_scopes > 0) {
+    throw std::runtime_error("Cannot intern " + std::string(name) +
+                             " while symbol scopes are open");
+  }
+  auto id = (SymbolId)s_names.size();
+  s_names.emplace_back(name);
+  s_ids.emplace(s_names.back(), id);
+  return id;
+}
+
+const std::string &symbol_name(SymbolId id) {
+  {
+    std::shared_lock guard(s_lock);
+    if (id < s_names.size()) {
+      return s_names[id];
+    }
+  }
+  if (t_scoped != nullptr && id - t_scoped->base < t_scoped->names.size()) {
+    return t_scoped->names[id - t_scoped->base];
+  }
+  throw std::runtime_error("Unknown symbol id");
+}
+
+std::size_t symbol_count() {
+  if (t_scoped != nullptr) {
+    return t_scoped->base + t_scoped->names.size();
+  }
+  std::shared_lock guard(s_lock);
+  return s_names.size();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Identifiers are interned once at parse time, after which the interpreter
+// only ever deals with their integer ids.
+using SymbolId = std::uint32_t;
+
+SymbolId intern(std::string_view name);
+const std::string &symbol_name(SymbolId id);
+std::size_t symbol_count();
+
+// While one of these is open, names that are new to the table are interned
+// for the current thread only, after the names the table already holds, and
+// they are forgotten again when it closes. The --serve workers open one per
+// request so that the names requests make up do not pile up in the table for
+// as long as the server runs. Ids handed out inside a scope must not be used
+// once it is closed, and the table itself cannot grow while any scope is
+// open.
+class SymbolScope {
+public:
+  SymbolScope();
+  ~SymbolScope();
+  SymbolScope(const SymbolScope &) = delete;
+  SymbolScope &operator=(const SymbolScope &) = delete;
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "heap.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Set while worker threads may share heap objects (see pool.hpp and
+// server.hpp). It is only flipped while no worker is running, so the plain
+// counts stay the fast path.
+inline bool g_shared_heap = false;
+
+// Anything that does not fit in an immediate lives on the heap behind one of
+// these. The reference count is intrusive so that a Value stays a single word.
+struct HeapObject {
+  mutable std::uint32_t refs = 0;
+  const void *kind = nullptr;
+
+  HeapObject() = default;
+  // A copy is a new object, nobody refers to it yet
+  HeapObject(const HeapObject &other) : kind(other.kind) {}
+  HeapObject &operator=(const HeapObject &) { return *this; }
+  virtual ~HeapObject() {}
+
+  // Counted in heap_stats()
+  static void *operator new(std::size_t size) { return heap_allocate(size); }
+  static void operator delete(void *ptr, std::size_t size) {
+    heap_free(ptr, size);
+  }
+
+  void retain() const {
+    if (g_shared_heap) {
+      std::atomic_ref<std::uint32_t>(refs).fetch_add(1,
+                                                     std::memory_order_relaxed);
+    } else {
+      ++refs;
+    }
+  }
+
+  std::uint32_t use_count() const {
+    if (g_shared_heap) {
+      return std::atomic_ref<std::uint32_t>(refs).load(
+          std::memory_order_acquire);
+    }
+    return refs;
+  }
+
+  // True when this dropped the last reference
+  bool release() const {
+    if (g_shared_heap) {
+      return std::atomic_ref<std::uint32_t>(refs).fetch_sub(
+                 1, std::memory_order_acq_rel) == 1;
+    }
+    return --refs == 0;
+  }
+};
+
+// Owning pointer to a HeapObject, sharing the same intrusive count as Value
+template <typename T> class Ref {
+public:
+  Ref() = default;
+  explicit Ref(T *ptr) : m_ptr(ptr) { retain(); }
+  Ref(const Ref &other) : m_ptr(other.m_ptr) { retain(); }
+  Ref(Ref &&other) noexcept : m_ptr(std::exchange(other.m_ptr, nullptr)) {}
+
+  Ref &operator=(Ref other) noexcept {
+    std::swap(m_ptr, other.m_ptr);
+    return *this;
+  }
+
+  ~Ref() { release(); }
+
+  T *get() const { return m_ptr; }
+  T *operator->() const { return m_ptr; }
+  T &operator*() const { return *m_ptr; }
+  explicit operator bool() const { return m_ptr != nullptr; }
+
+  // Only a uniquely owned object may be written to in place
+  bool unique() const { return m_ptr != nullptr && m_ptr->use_count() == 1; }
+
+private:
+  T *m_ptr = nullptr;
+
+  void retain() {
+    if (m_ptr != nullptr) {
+      m_ptr->retain();
+    }
+  }
+
+  void release() {
+    if (m_ptr != nullptr && m_ptr->release()) {
+      delete m_ptr;
+    }
+  }
+};
+
+template <typename T> struct Boxed : HeapObject {
+  static inline const char tag = 0;
+  T value;
+
+  explicit Boxed(T v) : value(std::move(v)) { kind = &tag; }
+};
+
+// A tagged word. The low three bits say what the rest of the word holds:
+// ints, bools, chars and enums are stored immediately in the upper 32 bits,
+// anything else is an (8-byte aligned) pointer to a HeapObject. Pointers to
+// types that already derive from HeapObject (and declare a static tag) are
+// stored as they are, everything else gets boxed.
+class Value {
+public:
+  enum Tag : std::uint64_t {
+    Heap = 0,
+    Int = 1,
+    Bool = 2,
+    Char = 3,
+    Enum = 4,
+  };
+
+  Value() = default;
+
+  template <typename T>
+    requires(!std::is_same_v<std::decay_t<T>, Value>)
+  Value(T v) {
+    static_assert(!std::is_same_v<T, const char *>,
+                  "string literals must be wrapped in std::string");
+    constexpr Tag tag = tag_for<T>();
+    if constexpr (std::is_pointer_v<T>) {
+      m_bits = reinterpret_cast<std::uintptr_t>(static_cast<HeapObject *>(v));
+      retain();
+    } else if constexpr (tag == Heap) {
+      m_bits = reinterpret_cast<std::uintptr_t>(new Boxed<T>(std::move(v)));
+      retain();
+    } else {
+      static_assert(sizeof(T) <= sizeof(std::uint32_t));
+      m_bits = (std::uint64_t)(std::uint32_t)v << 32 | tag;
+    }
+  }
+
+  Value(const Value &other) : m_bits(other.m_bits) { retain(); }
+  Value(Value &&other) noexcept : m_bits(std::exchange(other.m_bits, 0)) {}
+
+  Value &operator=(Value other) noexcept {
+    std::swap(m_bits, other.m_bits);
+    return *this;
+  }
+
+  ~Value() { release(); }
+
+  Tag tag() const { return Tag(m_bits & 7); }
+  bool has_value() const { return m_bits != 0; }
+
+  // Whether as<T>() would succeed
+  template <typename T> bool is() const {
+    constexpr Tag tag = tag_for<T>();
+    if (this->tag() != tag) {
+      return false;
+    }
+    if constexpr (std::is_pointer_v<T>) {
+      auto *obj = object();
+      return obj == nullptr || obj->kind == &std::remove_pointer_t<T>::tag;
+    } else if constexpr (tag == Heap) {
+      auto *obj = object();
+      return obj != nullptr && obj->kind == &Boxed<T>::tag;
+    } else {
+      return true;
+    }
+  }
+
+  // Immediates and heap pointers come back by value, boxed objects by const
+  // reference into the shared box.
+  template <typename T> decltype(auto) as() const {
+    constexpr Tag tag = tag_for<T>();
+    if (this->tag() != tag) {
+      throw std::runtime_error("Value::as() type mismatch");
+    }
+    if constexpr (std::is_pointer_v<T>) {
+      auto *obj = object();
+      if (obj != nullptr && obj->kind != &std::remove_pointer_t<T>::tag) {
+        throw std::runtime_error("Value::as() type mismatch");
+      }
+      return static_cast<T>(obj);
+    } else if constexpr (tag == Heap) {
+      auto *obj = object();
+      if (obj == nullptr || obj->kind != &Boxed<T>::tag) {
+        throw std::runtime_error("Value::as() type mismatch");
+      }
+      return static_cast<const T &>(static_cast<Boxed<T> *>(obj)->value);
+    } else {
+      return (T)(std::int32_t)(std::uint32_t)(m_bits >> 32);
+    }
+  }
+
+private:
+  std::uint64_t m_bits = 0;
+
+  template <typename T> static constexpr Tag tag_for() {
+    if constexpr (std::is_same_v<T, bool>) {
+      return Bool;
+    } else if constexpr (std::is_same_v<T, char>) {
+      return Char;
+    } else if constexpr (std::is_enum_v<T>) {
+      return Enum;
+    } else if constexpr (std::is_integral_v<T>) {
+      return Int;
+    } else if constexpr (std::is_pointer_v<T>) {
+      static_assert(std::is_base_of_v<HeapObject, std::remove_pointer_t<T>>,
+                    "only pointers to heap objects can be stored");
+      return Heap;
+    } else {
+      return Heap;
+    }
+  }
+
+  HeapObject *object() const {
+    return tag() == Heap ? reinterpret_cast<HeapObject *>(m_bits) : nullptr;
+  }
+
+  void retain() const {
+    if (auto *obj = object()) {
+      obj->retain();
+    }
+  }
+
+  void release() {
+    if (auto *obj = object()) {
+      if (obj->release()) {
+        delete obj;
+      }
+    }
+  }
+};
@@ -1,26 +1,40 @@
 #pragma once
 
+#include "expr.hpp"
 #include "node.hpp"
+#include "symbol.hpp"
+#include "value.hpp"
 
-#include <any>
-#include <string>
+#include <memory>
 #include <vector>
 
+class Jit;
+class Memo;
+struct Chunk;
+
 struct Function {
   Vector params;
-  std::vector<Node> body;
+  Expr body;
+  // What the spans in body point into, if anything
+  std::shared_ptr<const SourceMap> source;
+  // Only set when the function was defined by the bytecode compiler
+  std::shared_ptr<const Chunk> chunk;
+  // Only set for defn_memo, and shared by every copy of the function
+  std::shared_ptr<Memo> memo;
+  // Counts the calls and holds the native code once they make it hot (see
+  // jit.hpp), also shared by every copy
+  std::shared_ptr<Jit> jit;
 };
 
-using NativeFunction = std::function<Node(Interpreter &, std::vector<Node>)>;
-
+// A NativeFn holds the index of its builtin (see core.hpp)
 struct Variable {
   enum Type { Integer, String, Bool, Function, Vec, List, NativeFn } type;
-  std::string name;
-  std::any value;
-
-  template <typename T> T as() { return std::any_cast<T>(value); }
+  SymbolId name;
+  Value value;
 
-  template <typename T> T as() const { return std::any_cast<T>(value); }
+  template <typename T> decltype(auto) as() const { return value.as<T>(); }
 
-  inline bool is_function() { return type == Function || type == NativeFn; }
+  inline bool is_function() const {
+    return type == Function || type == NativeFn;
+  }
 };
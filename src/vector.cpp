@@ -0,0 +1,159 @@
+#include "node.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+// Makes the node behind ref safe to write to, copying it if it is shared
+template <typename T> T *own(Ref<HeapObject> &ref) {
+  if (!ref) {
+    ref = Ref<HeapObject>(new T());
+  } else if (!ref.unique()) {
+    ref = Ref<HeapObject>(new T(*static_cast<T *>(ref.get())));
+  }
+  return static_cast<T *>(ref.get());
+}
+
+Ref<HeapObject> new_path(std::size_t level, Ref<HeapObject> leaf) {
+  if (level == 0) {
+    return leaf;
+  }
+  auto *branch = new VecBranch();
+  branch->children[0] = new_path(level - Vector::Bits, std::move(leaf));
+  return Ref<HeapObject>(branch);
+}
+
+Ref<HeapObject> push_tail(std::size_t count, std::size_t level,
+                          Ref<HeapObject> parent, Ref<HeapObject> leaf) {
+  auto *branch = own<VecBranch>(parent);
+  auto sub = ((count - 1) >> level) & Vector::Mask;
+
+  if (level == Vector::Bits) {
+    branch->children[sub] = std::move(leaf);
+  } else if (auto child = std::move(branch->children[sub])) {
+    branch->children[sub] =
+        push_tail(count, level - Vector::Bits, std::move(child), std::move(leaf));
+  } else {
+    branch->children[sub] = new_path(level - Vector::Bits, std::move(leaf));
+  }
+
+  return parent;
+}
+
+Ref<HeapObject> assoc_path(std::size_t level, Ref<HeapObject> node,
+                           std::size_t raw, Node value) {
+  if (level == 0) {
+    own<VecLeaf>(node)->items[raw & Vector::Mask] = std::move(value);
+    return node;
+  }
+
+  auto *branch = own<VecBranch>(node);
+  auto sub = (raw >> level) & Vector::Mask;
+  branch->children[sub] = assoc_path(level - Vector::Bits,
+                                     std::move(branch->children[sub]), raw,
+                                     std::move(value));
+  return node;
+}
+
+} // namespace
+
+std::size_t Vector::tail_offset() const {
+  return m_count < Width ? 0 : ((m_count - 1) >> Bits) << Bits;
+}
+
+const VecLeaf *Vector::leaf_for(std::size_t raw) const {
+  if (raw >= tail_offset()) {
+    return static_cast<const VecLeaf *>(m_tail.get());
+  }
+
+  const HeapObject *node = m_root.get();
+  for (auto level = m_shift; level > 0; level -= Bits) {
+    node = static_cast<const VecBranch *>(node)
+               ->children[(raw >> level) & Mask]
+               .get();
+  }
+  return static_cast<const VecLeaf *>(node);
+}
+
+void Vector::append(Node node) {
+  if (m_count - tail_offset() < Width) {
+    own<VecLeaf>(m_tail)->items[m_count & Mask] = std::move(node);
+    ++m_count;
+    return;
+  }
+
+  // The tail is full: push it down into the trie and start a new one
+  auto leaf = std::move(m_tail);
+  if ((m_count >> Bits) > ((std::size_t)1 << m_shift)) {
+    auto *root = new VecBranch();
+    root->children[0] = std::move(m_root);
+    root->children[1] = new_path(m_shift, std::move(leaf));
+    m_root = Ref<HeapObject>(root);
+    m_shift += Bits;
+  } else {
+    m_root = push_tail(m_count, m_shift, std::move(m_root), std::move(leaf));
+  }
+
+  own<VecLeaf>(m_tail)->items[0] = std::move(node);
+  ++m_count;
+}
+
+void Vector::set(std::size_t raw, Node node) {
+  if (raw >= tail_offset()) {
+    own<VecLeaf>(m_tail)->items[raw & Mask] = std::move(node);
+  } else {
+    m_root = assoc_path(m_shift, std::move(m_root), raw, std::move(node));
+  }
+}
+
+const Node &Vector::operator[](std::size_t index) const {
+  if (index >= m_size) {
+    throw std::runtime_error("Vector index out of range");
+  }
+  auto raw = m_start + index;
+  return leaf_for(raw)->items[raw & Mask];
+}
+
+void Vector::push_back(Node node) {
+  // A narrowed vector overwrites whatever lies past its window
+  auto raw = m_start + m_size;
+  if (raw == m_count) {
+    append(std::move(node));
+  } else {
+    set(raw, std::move(node));
+  }
+  ++m_size;
+}
+
+Vector Vector::assoc(std::size_t index, Node node) const {
+  if (index > m_size) {
+    throw std::runtime_error("Vector index out of range");
+  }
+
+  Vector copy = *this;
+  if (index == m_size) {
+    copy.push_back(std::move(node));
+  } else {
+    copy.set(m_start + index, std::move(node));
+  }
+  return copy;
+}
+
+Vector Vector::subvec(std::size_t start, std::size_t end) const {
+  if (start > end || end > m_size) {
+    throw std::runtime_error("Vector index out of range");
+  }
+
+  Vector copy = *this;
+  copy.m_start += start;
+  copy.m_size = end - start;
+  return copy;
+}
+
+Vector Vector::concat(const Vector &other) const {
+  Vector copy = *this;
+  for (const auto &node : other) {
+    copy.push_back(node);
+  }
+  return copy;
+}
@@ -0,0 +1,442 @@
+#include "bytecode.hpp"
+#include "core.hpp"
+#include "expr.hpp"
+#include "interpreter.hpp"
+#include "memo.hpp"
+#include "node.hpp"
+#include "number.hpp"
+#include "profile.hpp"
+#include "variable.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LISPY_COMPUTED_GOTO
+#endif
+
+namespace {
+
+struct CallFrame {
+  // Holds on to the callee's Function in case it gets redefined while it runs
+  Value callee;
+  const Chunk *caller;
+  const Instruction *return_ip;
+  // Set when the callee was defined with defn_memo, along with the arguments
+  // its result is cached under on return
+  std::shared_ptr<Memo> memo;
+  Memo::Key key;
+  // The interpreter's caches for the calls in caller
+  CallCache *caller_caches = nullptr;
+};
+
+// Frames of the user function calls of every execute() on this thread. Each
+// one only looks at the frames above where it started, so a builtin that
+// calls back into the VM reuses the same storage instead of allocating its
+// own.
+thread_local std::vector<CallFrame> t_calls;
+
+// Drops the frames an execute() pushed, also when it throws
+struct CallsGuard {
+  std::size_t base;
+  ~CallsGuard() { t_calls.erase(t_calls.begin() + base, t_calls.end()); }
+};
+
+std::span<Node> top(std::vector<Node> &stack, std::size_t argc) {
+  return {stack.data() + stack.size() - argc, argc};
+}
+
+// User functions the VM runs in its own loop; anything else goes through
+// collapse()
+bool enters_directly(const Variable &sym) {
+  return sym.type == Variable::Function &&
+         sym.as<Function>().chunk != nullptr;
+}
+
+// The function a Call or TailCall instruction enters directly, if any, as
+// remembered by the interpreter's inline cache for it
+const CallCache &direct_callee(Interpreter &ctx, const Chunk &chunk,
+                               CallCache *caches, const Instruction *instr) {
+  auto &cache = caches[instr - chunk.code.data()];
+  if (cache.epoch == ctx.epoch()) {
+    return cache;
+  }
+
+  const auto *sym = ctx.get_symbol(instr->arg);
+  if (sym == nullptr) {
+    throw std::runtime_error("No such symbol exists");
+  }
+  cache = {ctx.epoch()};
+  if (enters_directly(*sym)) {
+    cache.sym = sym;
+    cache.func = &sym->as<Function>();
+    cache.callee_caches = ctx.call_caches(*cache.func->chunk);
+  }
+  return cache;
+}
+
+// Replaces the arguments of a memoized call with its result when that is
+// cached, and otherwise leaves the key to cache the result under in frame
+bool cached(CallFrame &frame, std::vector<Node> &stack, std::size_t first,
+            std::size_t nparams) {
+  frame.key = Memo::key({stack.data() + first, nparams});
+  auto hit = frame.memo->find(frame.key);
+  if (!hit) {
+    return false;
+  }
+  stack.resize(first);
+  stack.push_back(std::move(*hit));
+  return true;
+}
+
+// Outside of execute() because jumping to the next instruction's label leaves
+// a case without destroying its locals
+Node call_native(Interpreter &ctx, const Builtin &native,
+                 std::vector<Node> &stack, std::size_t argc) {
+  CallArgs args(top(stack, argc));
+  stack.resize(stack.size() - argc);
+  return native.call(ctx, args.get());
+}
+
+Node call_collapse(Interpreter &ctx, const Node &action,
+                   std::vector<Node> &stack, std::size_t argc) {
+  CallArgs args(top(stack, argc));
+  stack.resize(stack.size() - argc);
+  return collapse(ctx, action, args.get());
+}
+
+// Runs a hot callee as native code instead of entering it, replacing its
+// arguments with the result, when it can
+bool call_jit(Interpreter &ctx, const Variable &sym, std::vector<Node> &stack,
+              std::size_t first, std::size_t nparams) {
+  auto result = ctx.jit_call(sym, {stack.data() + first, nparams});
+  if (!result) {
+    return false;
+  }
+  stack.resize(first);
+  stack.push_back(std::move(*result));
+  return true;
+}
+
+// Builtins called by name show up in profiles, operators do not
+Node call_builtin(Interpreter &ctx, Profiler *profiler, std::size_t index,
+                  std::vector<Node> &stack, std::size_t argc) {
+  ProfileScope profile(profiler);
+  if (profiler != nullptr) {
+    profiler->enter_builtin(index);
+  }
+  return call_native(ctx, builtin(index), stack, argc);
+}
+
+// Binary operators on two small integers skip collapse() entirely, unless
+// the result overflows and has to be promoted
+bool fast_op(char op, int left, int right, Node &out) {
+  int result;
+  switch (op) {
+  case '+':
+    if (__builtin_add_overflow(left, right, &result)) {
+      return false;
+    }
+    out = {Node::Number, result};
+    return true;
+  case '-':
+    if (__builtin_sub_overflow(left, right, &result)) {
+      return false;
+    }
+    out = {Node::Number, result};
+    return true;
+  case '*':
+    if (__builtin_mul_overflow(left, right, &result)) {
+      return false;
+    }
+    out = {Node::Number, result};
+    return true;
+  case '=':
+    out = {Node::Bool, left == right};
+    return true;
+  case '<':
+    out = {Node::Bool, left < right};
+    return true;
+  case '>':
+    out = {Node::Bool, left > right};
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+Node Interpreter::execute(const Chunk &entry) {
+  auto &calls = t_calls;
+  CallsGuard guard{calls.size()};
+  auto stack_base = m_stack.size();
+  // Keeps the function alive once the entry chunk tail calls into another
+  Value entry_callee;
+
+  // Calls are reported as they are made and left as they return, and
+  // whatever an error skips over is left here
+  auto *profiling = profiler();
+  ProfileScope profile(profiling);
+  // Whether the entry chunk tail called a function, whose call then stands
+  // in for it the way a frame on calls does
+  bool entry_tail_call = false;
+
+  const Chunk *chunk = &entry;
+  CallCache *caches = call_caches(entry);
+  const Instruction *ip = chunk->code.data();
+  const Instruction *instr = ip;
+
+  // Every jump between instructions stays inside this block, which reports
+  // an error at the expression the instruction that raised it came from
+  try {
+#ifdef LISPY_COMPUTED_GOTO
+    // Must match the order of OpCode
+    static const void *labels[] = {
+        &&op_Const,  &&op_Local,       &&op_Pop,  &&op_Op,
+        &&op_Call,   &&op_Native,      &&op_TailCall, &&op_Apply,
+        &&op_Defn,   &&op_JumpIfFalse, &&op_Jump, &&op_Return,
+        &&op_Profile,
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) ==
+                  (std::size_t)OpCode::Profile + 1);
+#define VM_CASE(name) op_##name
+#define VM_DISPATCH()                                                          \
+  do {                                                                         \
+    instr = ip++;                                                              \
+    goto *labels[(std::size_t)instr->op];                                      \
+  } while (0)
+
+    VM_DISPATCH();
+#else
+#define VM_CASE(name) case OpCode::name
+#define VM_DISPATCH() continue
+
+    for (;;) {
+      instr = ip++;
+      switch (instr->op) {
+#endif
+
+    VM_CASE(Const) : {
+      m_stack.push_back(chunk->constants[instr->arg]);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Local) : {
+      m_stack.push_back(get_local(instr->arg >> 16, instr->arg & 0xffff));
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Pop) : {
+      m_stack.pop_back();
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Op) : {
+      char op = (char)instr->arg;
+      if (instr->argc == 2) {
+        auto &left = m_stack[m_stack.size() - 2];
+        auto &right = m_stack.back();
+        Node result;
+        if (left.type == Node::Number && right.type == Node::Number &&
+            Num::is_small(left.value) && Num::is_small(right.value) &&
+            fast_op(op, left.as<int>(), right.as<int>(), result)) {
+          m_stack.pop_back();
+          m_stack.back() = std::move(result);
+          VM_DISPATCH();
+        }
+      }
+      m_stack.push_back(
+          call_native(*this, operator_builtin(op), m_stack, instr->argc));
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Native) : {
+      m_stack.push_back(
+          call_builtin(*this, profiling, instr->arg, m_stack, instr->argc));
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Call) : {
+    call:
+      const auto &callee = direct_callee(*this, *chunk, caches, instr);
+      if (callee.func == nullptr) {
+        m_stack.push_back(call_collapse(*this, {Node::Global, instr->arg},
+                                        m_stack, instr->argc));
+        VM_DISPATCH();
+      }
+
+      const auto &func = *callee.func;
+      auto nparams = func.params.size();
+      if (instr->argc < nparams) {
+        throw std::runtime_error("Too few arguments");
+      }
+
+      // Arguments are evaluated in the caller's frame before ours is entered
+      auto first = m_stack.size() - instr->argc;
+      for (std::size_t i = 0; i < nparams; i++) {
+        auto &arg = m_stack[first + i];
+        if (arg.type != Node::Number) {
+          arg = arg.get_if_or(Node::Number, *this, Core::eval_id);
+        }
+      }
+
+      if (call_jit(*this, *callee.sym, m_stack, first, nparams)) {
+        VM_DISPATCH();
+      }
+
+      if (profiling != nullptr) {
+        profiling->enter(instr->arg);
+      }
+      calls.push_back({callee.sym->value, chunk, ip, func.memo, {}, caches});
+      if (func.memo && cached(calls.back(), m_stack, first, nparams)) {
+        calls.pop_back();
+        if (profiling != nullptr) {
+          profiling->leave();
+        }
+        VM_DISPATCH();
+      }
+
+      auto base = m_locals.size();
+      for (std::size_t i = 0; i < nparams; i++) {
+        m_locals.push_back(std::move(m_stack[first + i]));
+      }
+      m_stack.resize(first);
+      enter_frame(base);
+
+      chunk = func.chunk.get();
+      caches = callee.callee_caches;
+      ip = chunk->code.data();
+      VM_DISPATCH();
+    }
+
+    VM_CASE(TailCall) : {
+      const auto &callee = direct_callee(*this, *chunk, caches, instr);
+      if (callee.func == nullptr) {
+        m_stack.push_back(call_collapse(*this, {Node::Global, instr->arg},
+                                        m_stack, instr->argc));
+        VM_DISPATCH();
+      }
+
+      // A memoized call has to see its own result, so it is made as a regular
+      // call that returns here
+      if (callee.func->memo) {
+        goto call;
+      }
+
+      const auto &func = *callee.func;
+      auto nparams = func.params.size();
+      if (instr->argc < nparams) {
+        throw std::runtime_error("Too few arguments");
+      }
+
+      // Arguments still see the current frame, so evaluate them before it is
+      // overwritten with the callee's parameters
+      auto first = m_stack.size() - instr->argc;
+      for (std::size_t i = 0; i < nparams; i++) {
+        auto &arg = m_stack[first + i];
+        if (arg.type != Node::Number) {
+          arg = arg.get_if_or(Node::Number, *this, Core::eval_id);
+        }
+      }
+      if (call_jit(*this, *callee.sym, m_stack, first, nparams)) {
+        VM_DISPATCH();
+      }
+
+      if (profiling != nullptr) {
+        if (calls.size() > guard.base || entry_tail_call) {
+          profiling->leave();
+        }
+        entry_tail_call = calls.size() == guard.base;
+        profiling->enter(instr->arg);
+      }
+      m_locals.resize(m_frames.back());
+      for (std::size_t i = 0; i < nparams; i++) {
+        m_locals.push_back(std::move(m_stack[first + i]));
+      }
+      m_stack.resize(first);
+
+      (calls.size() == guard.base ? entry_callee : calls.back().callee) =
+          callee.sym->value;
+      chunk = func.chunk.get();
+      caches = callee.callee_caches;
+      ip = chunk->code.data();
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Apply) : {
+      m_stack.push_back(call_collapse(*this, chunk->constants[instr->arg],
+                                      m_stack, instr->argc));
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Defn) : {
+      const auto &proto = chunk->constants[instr->arg];
+      const auto &v = proto.as<Variable>();
+      add_symbol(v.name, v);
+      m_stack.push_back(proto);
+      VM_DISPATCH();
+    }
+
+    VM_CASE(JumpIfFalse) : {
+      auto cond = std::move(m_stack.back());
+      m_stack.pop_back();
+      if (!cond.get_if(Node::Bool).as<bool>()) {
+        ip = chunk->code.data() + instr->arg;
+      }
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Jump) : {
+      ip = chunk->code.data() + instr->arg;
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Return) : {
+      if (calls.size() == guard.base) {
+        auto result = std::move(m_stack.back());
+        m_stack.resize(stack_base);
+        return result;
+      }
+
+      auto &frame = calls.back();
+      if (frame.memo) {
+        frame.memo->insert(std::move(frame.key), m_stack.back());
+      }
+
+      if (profiling != nullptr) {
+        profiling->leave();
+      }
+      leave_frame();
+      chunk = calls.back().caller;
+      caches = calls.back().caller_caches;
+      ip = calls.back().return_ip;
+      calls.pop_back();
+      VM_DISPATCH();
+    }
+
+    VM_CASE(Profile) : {
+      if (instr->arg != 0) {
+        begin_profile();
+      } else {
+        end_profile();
+      }
+      profiling = profiler();
+      VM_DISPATCH();
+    }
+
+#ifndef LISPY_COMPUTED_GOTO
+      }
+    }
+#endif
+  } catch (...) {
+    rethrow_at(chunk->spans[instr - chunk->code.data()], chunk->source);
+  }
+
+#undef VM_CASE
+#undef VM_DISPATCH
+}
@@ -0,0 +1,19 @@
+; Forms are evaluated in order, may span lines and are printed with -p
+(def base 40) ; a comment after a form
+(defn game [guess answer]
+  (if (= answer guess)
+    (0)
+    (if (> guess answer) (1) (2))))
+(game 50 42)
+(game 42 42)
+
+(def v [1 2
+        3 4])
+(nth 2 v)
+(+ base
+   ; a comment inside a form
+   2)
+; The first error stops the run
+(+ 1
+   (undefined 2))
+(+ 1 2)
@@ -0,0 +1,22 @@
+(+ 1 2.5)
+(* 3 0.5)
+(- 10 0.25)
+(/ 7 2.0)
+(/ 1 3.0)
+(+ 0.1 0.2)
+(< 1 1.5)
+(> 2.5 2)
+(= 2 2.0)
+(+ 9223372036854775807 0.5)
+(* 99999999999999999999 2.5)
+(sqrt 2)
+(sqrt 2.25)
+(rem 7.5 2)
+(/ 1.0 0)
+(defn half [x] (/ x 2.0))
+(half 5)
+(defn mix [x y] (+ x y 1))
+(mix 1.5 2)
+(mix 2147483647 0.5)
+(map half [1 2 3])
+(reduce + [0.5 1 2])
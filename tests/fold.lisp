@@ -0,0 +1,15 @@
+(defn h [x] (+ x 1 2))
+(h 10000000000000000.0)
+(+ 10000000000000000.0 1 2)
+(defn g [x y] (* x 3 y 5))
+(g 0.1 0.7)
+(* 0.1 3 0.7 5)
+(defn k [x] (+ 1 2 x 3 4))
+(k 10000000000000000.0)
+(+ 1 2 10000000000000000.0 3 4)
+(defn m [x] (* 2 3 x))
+(m 7)
+(defn n [x] (+ 0.5 0.25 x 1))
+(n 2)
+(defn lit [] (+ 1 2 3))
+(lit)
@@ -0,0 +1,11 @@
+(defn fib [n] (if (< n 2) (n) (+ (fib (- n 1)) (fib (- n 2)))))
+(defn_memo mf [n] (if (< n 2) (n) (+ (mf (- n 1)) (mf (- n 2)))))
+(defn f [x] (+ 1.5 x 2 3))
+(def big 123456789012345678901234567890)
+(def v [1 2 3])
+(def l '(1 3000000000 2.5))
+(defn g [x y] (* x (f y) 2.5))
+(defn lp [n acc] (if (= n 0) (acc) (lp (- n 1) (+ acc 1))))
+(defn h [a] (reduce + (map fib (range 1 a))))
+(def fl 2.25)
+(def w 5000000000)
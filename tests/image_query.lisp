@@ -0,0 +1,11 @@
+(fib 20)
+(mf 80)
+(g 2 3)
+(lp 10000 0)
+(h 10)
+big
+v
+l
+fl
+w
+(+ big w fl)
@@ -0,0 +1,39 @@
+; Each function runs well past the thousand calls that get it compiled, and
+; has to give what the interpreter does, down to the calls where the native
+; code hands back because a number outgrew 64 bits or a division failed
+(defn fib [n] (if (< n 2) (n) (+ (fib (- n 1)) (fib (- n 2)))))
+(fib 25)
+(defn loop [i acc] (if (= i 0) (acc) (loop (- i 1) (+ acc i))))
+(loop 1000000 0)
+(defn count [n] (if (= n 0) (0) (+ 1 (count (- n 1)))))
+(count 5000)
+(count 1000)
+(count 1000)
+(defn fact [n] (if (< n 2) (1) (* n (fact (- n 1)))))
+(defn fsum [i acc] (if (= i 0) (acc) (fsum (- i 1) (+ acc (fact (rem i 40))))))
+(fsum 3000 0)
+(defn sq [x] (* x x))
+(defn sqsum [i acc] (if (= i 0) (acc) (sqsum (- i 1) (+ acc (sq (* i 1000000))))))
+(sqsum 5000 0)
+(defn dv [x] (/ 100 (- x 2000)))
+(defn dvsum [i acc] (if (= i 0) (acc) (dvsum (- i 1) (+ acc (dv i)))))
+(dvsum 1999 0)
+(defn rm [x y] (rem x y))
+(defn rmsum [i acc] (if (= i 0) (acc) (rmsum (- i 1) (+ acc (rm (- 0 i) (- 0 (+ 7 (rem i 5))))))))
+(rmsum 3000 0)
+(defn odd [x] (if (= (rem x 2) 1) (true) (false)))
+(defn cnt [i acc] (if (= i 0) (acc) (cnt (- i 1) (if (odd i) (+ acc 1) (+ acc 0)))))
+(cnt 3000 0)
+(defn mn [a b c] (- a b c))
+(defn msum [i acc] (if (= i 0) (acc) (msum (- i 1) (+ acc (mn i 1 2)))))
+(msum 3000 0)
+(defn ng [a] (- a))
+(defn nsum [i acc] (if (= i 0) (acc) (nsum (- i 1) (+ acc (ng i)))))
+(nsum 3000 0)
+(defn m0 [] (+))
+(defn m0sum [i acc] (if (= i 0) (acc) (m0sum (- i 1) (+ acc (m0) (*)))))
+(m0sum 3000 0)
+(defn k [x] (+ x 9223372036854775000))
+(defn ksum [i acc] (if (= i 0) (acc) (ksum (- i 1) (k i))))
+(ksum 3000 0)
+(dv 2000)
@@ -0,0 +1,86 @@
+// Checks that the lexer produces the same tokens however its input is split
+// into chunks, in particular when a token straddles the boundary between two.
+
+#include "parser.hpp"
+#include "symbol.hpp"
+
+#include <cstddef>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+const char *const Sources[] = {
+    "(defn fib [n] (if (< n 2) (n) (+ (fib (- n 1)) (fib (- n 2)))))",
+    "(def counter 1234567)\n(+ counter 89)",
+    "  '(1 22 333)\r\n[4444 55555]  ",
+    "(defn_x truthy false)",
+    "abcdefghijklmnopqrstuvwxyz",
+    "; a comment (with a form in it)\n(+ 1 2) ; and one after\n3",
+};
+
+std::vector<Token> lex(std::string_view source,
+                       const std::vector<std::size_t> &cuts) {
+  std::vector<Token> tokens;
+  Lexer lexer;
+  std::size_t start = 0;
+  for (auto cut : cuts) {
+    lexer.feed(source.substr(start, cut - start), tokens);
+    start = cut;
+  }
+  lexer.feed(source.substr(start), tokens);
+  lexer.finish(tokens);
+  return tokens;
+}
+
+// Tokens only compare equal if they cover the same text, so a word that was
+// cut in two shows up as a mismatch in offsets or lengths
+bool same(std::string_view source, const Token &a, const Token &b) {
+  if (a.type != b.type || a.offset != b.offset || a.length != b.length) {
+    return false;
+  }
+  if (a.type == Token::Identifier) {
+    return a.as<SymbolId>() == b.as<SymbolId>() &&
+           symbol_name(a.as<SymbolId>()) == source.substr(a.offset, a.length);
+  }
+  return true;
+}
+
+bool check(std::string_view source, const std::vector<std::size_t> &cuts,
+           const std::vector<Token> &want) {
+  auto got = lex(source, cuts);
+  bool ok = got.size() == want.size();
+  for (std::size_t i = 0; ok && i < got.size(); i++) {
+    ok = same(source, got[i], want[i]);
+  }
+  if (!ok) {
+    std::cout << "\"" << source << "\" cut at";
+    for (auto cut : cuts) {
+      std::cout << " " << cut;
+    }
+    std::cout << ": " << got.size() << " tokens instead of " << want.size()
+              << std::endl;
+  }
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  int failures = 0;
+  for (std::string_view source : Sources) {
+    auto want = parse(source);
+
+    // Every way of cutting the source in two, and into single bytes
+    for (std::size_t cut = 0; cut <= source.size(); cut++) {
+      failures += !check(source, {cut}, want);
+    }
+    std::vector<std::size_t> bytes;
+    for (std::size_t cut = 1; cut < source.size(); cut++) {
+      bytes.push_back(cut);
+    }
+    failures += !check(source, bytes, want);
+  }
+  return failures == 0 ? 0 : 1;
+}
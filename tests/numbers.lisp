@@ -0,0 +1,36 @@
+(def min64 (- 0 9223372036854775807 1))
+(def neg1 (- 0 1))
+min64
+(- min64 1)
+(- 0 min64)
+(/ min64 neg1)
+(* min64 neg1)
+(rem min64 neg1)
+(/ (- 0 2147483648) neg1)
+(* (- 0 2147483648) neg1)
+(+ 2147483647 1)
+(- (- 0 2147483647) 2)
+(* 4294967296 4294967296)
+(/ 340282366920938463463374607431768211456 4294967296)
+(- 340282366920938463463374607431768211456 340282366920938463463374607431768211455)
+(rem (- 0 7) 2)
+(/ 7 2)
+(/ (- 0 7) 2)
+(= 9223372036854775808 (+ 9223372036854775807 1))
+(< 9223372036854775807 9223372036854775808)
+(> min64 (- min64 1))
+(defn sq [x] (* x x))
+(sq 3037000499)
+(sq 3037000500)
+(sq min64)
+(defn fact [n] (if (< n 2) (1) (* n (fact (- n 1)))))
+(fact 25)
+(defn sqsum [i acc] (if (= i 0) (acc) (sqsum (- i 1) (+ acc (sq (+ i 3037000000))))))
+(sqsum 2000 0)
+(defn neg [x] (- 0 x))
+(defn negsum [i acc] (if (= i 0) (acc) (negsum (- i 1) (+ acc (neg min64)))))
+(negsum 2000 0)
+(defn quo [x] (/ x neg1))
+(defn quosum [i acc] (if (= i 0) (acc) (quosum (- i 1) (+ acc (quo min64)))))
+(quosum 2000 0)
+(/ 1 0)
@@ -0,0 +1,28 @@
+; pmap, pfilter and preduce split vectors of 1024 elements or more across the
+; pool, and have to give the same results in the same order as map, filter
+; and reduce
+(def v (range 1 1500))
+(defn sq [x] (* x x))
+(defn odd [x] (= (rem x 2) 1))
+(defn add [a b] (+ a b))
+; Depends on the order of the elements it is reduced over
+(defn hash [acc x] (rem (+ (* acc 31) x) 1000003))
+(def squares (pmap sq v))
+(size squares)
+(nth 0 squares)
+(nth 1499 squares)
+(reduce hash squares)
+(reduce hash (map sq v))
+(def odds (pfilter odd v))
+(size odds)
+(reduce hash odds)
+(reduce hash (filter odd v))
+(preduce add v)
+(preduce add squares)
+(preduce + squares)
+; A function that can reach a def is not pure, so it is run in order on the
+; calling interpreter, where what it defines stays visible
+(defn mark [x] (if (< x 1500) (x) (def last x)))
+(nth 1499 (pmap mark v))
+last
+(size (pfilter odd (pmap sq v)))
@@ -0,0 +1,8 @@
+; Only spin runs long enough to be sure of a line in the folded output. It
+; tail calls itself, which replaces its entry rather than nesting under it.
+(defn spin [n] (if (= n 0) (0) (spin (- n 1))))
+(defn twice [n] (+ (spin n) (spin n)))
+(defn add_spin [acc n] (+ acc (spin n)))
+(twice 20000)
+(spin 20000)
+(reduce add_spin [20000 20000])
@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+"""Runs the lisp binary on a fixture and compares what it prints with the
+fixture's .out file.
+
+    run.py LISP FIXTURE.lisp
+        Runs the fixture on the bytecode VM, on the tree walker and with the
+        JIT turned off, both as a file and fed to standard input, each of
+        which has to print the same.
+        Errors on standard input are reported as <stdin> rather than by the
+        fixture's name. A program stops at its first error, so a fixture can
+        hold several, each after a line that is just ";;;".
+
+    run.py --image LISP SETUP.lisp QUERY.lisp
+        Saves the globals of SETUP into an image, loads it back to run QUERY,
+        and compares with QUERY's .out. Then checks that every truncation of
+        the image and a fixed set of corruptions of it are rejected or loaded
+        without the process dying.
+
+    run.py --profile LISP FIXTURE.lisp
+        Runs the fixture with --profile in each of the modes above. What
+        it prints, the table of calls without its timings, and the stacks of
+        the folded output that no other stack extends, have to match the .out.
+
+    run.py --serve LISP PRELUDE.lisp
+        Starts a server on a temporary socket with PRELUDE, and sends it a
+        seeded mix of requests from several clients at once. Each has to get
+        back exactly its own output or error, and see the prelude's globals
+        but nothing another request defined.
+
+The parallel builtins are given a pool of several threads even on a machine
+with a single core, so that they always take their parallel path.
+"""
+
+import os
+import random
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+MODES = [[], ['--tree-walk'], ['--no-jit']]
+
+ENV = dict(os.environ, LISPY_THREADS='4')
+
+# Seeded so that a failure can be reproduced
+CORRUPTIONS = 500
+
+REQUESTS = 400
+CLIENTS = 16
+
+
+def run(lisp, args, cwd=None, stdin=None, timeout=120):
+    return subprocess.run([lisp] + args, cwd=cwd, input=stdin, env=ENV,
+                          capture_output=True, text=True, timeout=timeout)
+
+
+def output(result):
+    return result.stdout + result.stderr
+
+
+def expected(fixture):
+    with open(os.path.splitext(fixture)[0] + '.out') as f:
+        return f.read()
+
+
+def fail(message):
+    print(message)
+    sys.exit(1)
+
+
+def compare(name, want, got):
+    if want != got:
+        fail(f'{name}: expected\n{want}\nbut got\n{got}')
+
+
+# A run that reported an error has to exit with status 1, and any other 0
+def status(name, result):
+    want = 1 if result.stderr else 0
+    if result.returncode != want:
+        fail(f'{name}: exited with {result.returncode} instead of {want}')
+
+
+# The programs of a fixture, each with blank lines in place of the ones
+# before it so that errors point at the same lines as in the fixture
+def programs(source):
+    lines = source.splitlines(keepends=True)
+    starts = [0] + [i + 1 for i, line in enumerate(lines)
+                    if line.rstrip('\n') == ';;;']
+    ends = [start - 1 for start in starts[1:]] + [len(lines)]
+    return ['\n' * start + ''.join(lines[start:end])
+            for start, end in zip(starts, ends)]
+
+
+def modes(lisp, fixture):
+    name = os.path.basename(fixture)
+    want = expected(fixture)
+    with open(fixture) as f:
+        sources = programs(f.read())
+    # Each program is run as a file of the fixture's name, so that errors
+    # name it the same everywhere
+    with tempfile.TemporaryDirectory() as cwd:
+        for mode in MODES:
+            label = ' '.join([name] + mode)
+            got = ''
+            for source in sources:
+                with open(os.path.join(cwd, name), 'w') as f:
+                    f.write(source)
+                result = run(lisp, mode + ['-p', name], cwd)
+                got += output(result)
+                status(label, result)
+            compare(label, want, got)
+
+            label = ' '.join(['<stdin>'] + mode)
+            got = ''
+            for source in sources:
+                result = run(lisp, mode + ['-p', '-'], cwd, stdin=source)
+                got += output(result)
+                status(label, result)
+            compare(label, want.replace(name + ':', '<stdin>:'), got)
+
+
+# Timings differ from run to run, so the table keeps only its calls, and the
+# folded output only its stacks. A caller's own time may well be under the
+# microsecond the folded output counts in, so only the innermost stacks are
+# sure to be there.
+def profile(lisp, fixture):
+    cwd, name = os.path.split(os.path.abspath(fixture))
+    want = expected(fixture)
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'out.folded')
+        for mode in MODES:
+            label = ' '.join([name, '--profile'] + mode)
+            result = run(lisp, mode + ['--profile', path, '-p', name], cwd)
+            if result.returncode != 0:
+                fail(f'{label}: exited with {result.returncode}:\n'
+                     f'{output(result)}')
+
+            header, *rows = result.stderr.splitlines()
+            table = [header.split()[0] + ' ' + header.split()[-1]]
+            for row in sorted(rows, key=lambda row: row.split()[-1]):
+                calls, _, _, function = row.split()
+                table.append(calls + ' ' + function)
+
+            stacks = []
+            with open(path) as f:
+                for line in f:
+                    stack, weight = line.split()
+                    if not weight.isdigit() or int(weight) == 0:
+                        fail(f'{label}: bad folded line {line!r}')
+                    stacks.append(stack)
+            leaves = sorted(stack for stack in stacks
+                            if not any(other.startswith(stack + ';')
+                                       for other in stacks))
+
+            got = result.stdout + '\n'.join(table + leaves) + '\n'
+            compare(label, want, got)
+
+
+def image(lisp, setup, query):
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'lispy.img')
+        result = run(lisp, ['--dump-image', path, setup])
+        if result.returncode != 0:
+            fail(f'--dump-image failed:\n{output(result)}')
+
+        cwd, name = os.path.split(os.path.abspath(query))
+        for mode in MODES:
+            got = output(run(lisp, mode + ['--image', path, '-p', name], cwd))
+            compare(' '.join([name, '--image'] + mode), expected(query), got)
+
+        with open(path, 'rb') as f:
+            data = f.read()
+        bad = os.path.join(tmp, 'bad.img')
+
+        def load(corrupt):
+            with open(bad, 'wb') as f:
+                f.write(corrupt)
+            return run(lisp, ['--image', bad, '-p', name], cwd, timeout=10)
+
+        for size in range(len(data)):
+            result = load(data[:size])
+            if result.returncode != 1 or 'bad.img: ' not in result.stderr:
+                fail(f'image truncated to {size} bytes was not rejected:\n'
+                     f'{output(result)}')
+
+        rng = random.Random(0)
+        for i in range(CORRUPTIONS):
+            corrupt = bytearray(data)
+            for _ in range(rng.randint(1, 4)):
+                corrupt[rng.randrange(len(corrupt))] = rng.randrange(256)
+            try:
+                result = load(bytes(corrupt))
+            except subprocess.TimeoutExpired:
+                # A changed constant can make a query loop forever
+                continue
+            if result.returncode not in (0, 1):
+                with open(path + '.crash', 'wb') as f:
+                    f.write(corrupt)
+                fail(f'corruption {i} killed the process '
+                     f'({result.returncode}):\n{output(result)}')
+
+
+def request(path, program):
+    with socket.socket(socket.AF_UNIX) as client:
+        client.connect(path)
+        client.sendall(program.encode())
+        client.shutdown(socket.SHUT_WR)
+        response = b''
+        while data := client.recv(4096):
+            response += data
+    return response.decode()
+
+
+# Programs for the prelude in tests/serve.lisp, which defines fib and sets
+# base to 40, and what each has to answer. Redefining base or defining secret
+# must not show in any other request, and an error is reported at a line and
+# column that differ from one request to the next.
+def requests():
+    rng = random.Random(0)
+    programs = []
+    for i in range(REQUESTS):
+        kind = rng.randrange(4)
+        if kind == 0:
+            programs.append((f'(def secret {i})\n(def base {i})\n'
+                             f'(+ secret base)',
+                             f'#secret\n#base\n{2 * i}\n'))
+        elif kind == 1:
+            programs.append(('base\nsecret\n(+ base 1)',
+                             "40\n'secret' is undefined\n41\n"))
+        elif kind == 2:
+            programs.append(('\n' * (i % 50) + ' ' * (i % 7) +
+                             '(/ base 0)\n(fib 30)',
+                             f'<request>:{i % 50 + 1}:{i % 7 + 1}: '
+                             'Division by zero\n'))
+        else:
+            programs.append((f'(fib {i % 20})', f'{fib(i % 20)}\n'))
+    return programs
+
+
+def fib(n):
+    return n if n < 2 else fib(n - 1) + fib(n - 2)
+
+
+def serve(lisp, prelude):
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'lispy.sock')
+        server = subprocess.Popen([lisp, '--serve', path, '--workers', '4',
+                                   prelude], env=ENV, stderr=subprocess.PIPE,
+                                  text=True)
+        try:
+            for _ in range(100):
+                if os.path.exists(path) or server.poll() is not None:
+                    break
+                time.sleep(0.1)
+
+            programs = requests()
+            with ThreadPoolExecutor(CLIENTS) as clients:
+                responses = list(clients.map(
+                    lambda program: request(path, program[0]), programs))
+            for (program, want), got in zip(programs, responses):
+                compare(f'request {program!r}', want, got)
+        finally:
+            server.send_signal(signal.SIGINT)
+            _, log = server.communicate(timeout=30)
+
+        if server.returncode != 0:
+            fail(f'--serve exited with {server.returncode}:\n{log}')
+        errors = sum(want.startswith('<request>:') for _, want in programs)
+        if log.count(', error\n') != errors:
+            fail(f'--serve logged the wrong number of errors:\n{log}')
+
+
+def main():
+    if len(sys.argv) == 5 and sys.argv[1] == '--image':
+        image(*sys.argv[2:])
+    elif len(sys.argv) == 4 and sys.argv[1] == '--profile':
+        profile(*sys.argv[2:])
+    elif len(sys.argv) == 4 and sys.argv[1] == '--serve':
+        serve(*sys.argv[2:])
+    elif len(sys.argv) == 3:
+        modes(*sys.argv[1:])
+    else:
+        fail(__doc__)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,36 @@
+(def big (range 1 100000))
+(size big)
+(nth 0 big)
+(nth 32 big)
+(nth 99998 big)
+(def a (assoc big 40000 7))
+(nth 40000 a)
+(nth 40000 big)
+(def s (subvec big 10 20))
+s
+(conj s 1 2)
+(concat s (range 1 3))
+(size (concat big big))
+(defn odd [x] (= (rem x 2) 1))
+(defn sq [x] (* x x))
+(size (filter odd (map sq big)))
+(reduce + (map sq (range 1 1000)))
+(preduce + (pmap sq (conj (range 1 2000))))
+(size (pfilter odd (conj (range 1 2000))))
+(def l '(3000000000 1 2.5 99999999999999999999999))
+l
+(head l)
+(tail l)
+(len l)
+(nth 3 l)
+(+ (head l) 1)
+(defn_memo fibm [n] (if (< n 2) (n) (+ (fibm (- n 1)) (fibm (- n 2)))))
+(fibm 90)
+(memo_stats fibm)
+(def x 3)
+(def y x)
+y
+(def v [1 2 3])
+(def w v)
+w
+(nth 5 v)